@@ -219,12 +219,16 @@ void analyze_render(GLuint tex_spectrum, GLuint tex_waveform, GLuint tex_wavefor
     glBindTexture(GL_TEXTURE_1D, tex_waveform_beats);
     glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA32F, config.audio.waveform_length, 0, GL_RGBA, GL_FLOAT, &waveform_beats_gl[waveform_ptr * 4]);
     glBindTexture(GL_TEXTURE_1D, 0);
+    SDL_UnlockMutex(mutex);
+}
 
+// This is called from the OpenGL Thread, once per frame
+void analyze_update() {
+    if (SDL_LockMutex(mutex) != 0) FAIL("Could not lock mutex!");
     audio_hi = audio_thread_hi;
     audio_mid = audio_thread_mid;
     audio_low = audio_thread_low;
     audio_level = audio_thread_level;
-
     SDL_UnlockMutex(mutex);
 }
 
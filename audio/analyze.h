@@ -5,5 +5,6 @@
 
 void analyze_init();
 void analyze_chunk(chunk_pt chunk);
+void analyze_update();
 void analyze_render(GLuint tex_spectrum, GLuint tex_waveform, GLuint tex_waveform_beats);
 void analyze_term();
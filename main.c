@@ -6,12 +6,17 @@
 #include "ui/render.h"
 #include "util/config.h"
 #include "util/err.h"
+#include "util/gl.h"
+#include "util/texpool.h"
+#include "pattern/catalog.h"
 #include "pattern/deck.h"
+#include "pattern/pattern.h"
 #include "pattern/crossfader.h"
 #include "midi/midi.h"
 #include "audio/audio.h"
 #include "audio/analyze.h"
 #include "time/timebase.h"
+#include "time/pacer.h"
 #include "output/output.h"
 #include "main.h"
 
@@ -25,14 +30,112 @@ double audio_mid;
 double audio_low;
 double audio_level;
 
+#define STAT_FRAMES 300
+
+// Load the deck sets & crossfader position from [headless]
+static void headless_setup() {
+    for(int i = 0; i < N_DECKS && i < config.headless.n_sets; i++) {
+        const char * set = config.headless.sets[i];
+        if(set[0] == '\0') continue;
+        if(deck_load_set(&deck[i], set) != 0) ERROR("Could not load set '%s' on deck %d", set, i);
+    }
+    crossfader.position = config.headless.crossfader;
+}
+
+// Render decks & crossfader at render.fps; the UI is drawn in between at ui.fps.
+// Both run on this thread with the one GL context, so only the pacing is
+// separate: a slow UI frame (or a blocking event) still delays the next engine frame
+static void engine_run() {
+    struct pacer engine;
+    struct pacer ui;
+    pacer_init(&engine, config.render.fps);
+    pacer_init(&ui, config.ui.fps);
+
+    int stat_frames = 0;
+    int stat_skipped = 0;
+    int stat_fused = 0;
+    int stat_memoized = 0;
+    int stat_sparse = 0;
+    struct gl_timer deck_timer;
+    gl_timer_init(&deck_timer);
+
+    while(ui_poll()) {
+        pacer_wait(&engine);
+
+        catalog_update();
+        analyze_update();
+        pattern_globals_update(engine.dt, engine.fps);
+
+        // Mark which deck & pattern outputs can be seen this frame,
+        // so that deck_render() can skip everything else
+        for(int i = 0; i < N_DECKS; i++) {
+            deck[i].output_needed = false;
+            for(int j = 0; j < config.deck.n_patterns; j++) {
+                if(deck[i].pattern[j] != NULL) deck[i].pattern[j]->preview = false;
+            }
+        }
+        if(crossfader.position < 1.) deck[crossfader.left_deck].output_needed = true;
+        if(crossfader.position > 0.) deck[crossfader.right_deck].output_needed = true;
+        ui_mark_previews();
+
+        // Without the UI, nothing needs the whole canvas past the last pattern
+        // that samples its neighbours; the rest only has to be evaluated at the output pixels
+        render_update_layout(&render);
+        struct pattern_sparse sparse = {
+            .coord_tex = render.coord_tex,
+            .width = render.readback_width,
+            .height = render.readback_height,
+        };
+        const struct pattern_sparse * sparse_layout = pattern_sparse_enabled() && render.n_samples > 0 ? &sparse : NULL;
+
+        gl_timer_begin(&deck_timer);
+        for(int i = 0; i < N_DECKS; i++) {
+            deck_render(&deck[i], sparse_layout);
+            stat_skipped += deck[i].n_skipped;
+            stat_fused += deck[i].n_fused;
+            stat_memoized += deck[i].n_memoized;
+            stat_sparse += deck[i].n_sparse;
+        }
+        gl_timer_end(&deck_timer);
+        crossfader_render(&crossfader, &deck[crossfader.left_deck], &deck[crossfader.right_deck], sparse_layout);
+        render_readback(&render, crossfader.sparse ? crossfader.tex_sparse : 0);
+
+        if(pacer_ready(&ui)) ui_draw();
+
+        time += engine.dt;
+
+        if(++stat_frames == STAT_FRAMES) {
+            struct texpool_stats pool;
+            texpool_stats(&pool);
+            DEBUG("Engine %0.1f fps (%d late); UI %0.1f fps; skipped %0.1f, fused %0.1f & memoized %0.1f pattern passes/frame; %0.1f patterns/frame sparse",
+                  engine.fps, engine.n_late, ui.fps, (double) stat_skipped / STAT_FRAMES,
+                  (double) stat_fused / STAT_FRAMES, (double) stat_memoized / STAT_FRAMES,
+                  (double) stat_sparse / STAT_FRAMES);
+            double deck_ms = gl_timer_average(&deck_timer);
+            if(deck_ms >= 0) DEBUG("Decks took %0.2f ms/frame on the GPU", deck_ms);
+            DEBUG("Texture pool: %d textures, %d in use, peak %d, %lu allocated",
+                  pool.size, pool.in_use, pool.peak, pool.allocations);
+            stat_frames = 0;
+            stat_skipped = 0;
+            stat_fused = 0;
+            stat_memoized = 0;
+            stat_sparse = 0;
+            engine.n_late = 0;
+        }
+    }
+    gl_timer_term(&deck_timer);
+}
+
 int main(int argc, char* args[]) {
     config_init(&config);
     config_load(&config, "resources/config.ini");
     params_init(&params);
     params_refresh();
+    catalog_init();
 
     ui_init();
 
+    pattern_globals_init();
     for(int i=0; i < N_DECKS; i++) {
         deck_init(&deck[i]);
     }
@@ -44,7 +147,8 @@ int main(int argc, char* args[]) {
     midi_start();
     output_init(&render);
 
-    ui_run();
+    if(config.headless.enabled) headless_setup();
+    engine_run();
     ui_term();
 
     output_term();
@@ -55,9 +159,12 @@ int main(int argc, char* args[]) {
     for(int i=0; i < N_DECKS; i++) {
         deck_term(&deck[i]);
     }
+    pattern_globals_term();
 
     render_term(&render);
     crossfader_term(&crossfader);
+    texpool_term();
+    catalog_term();
 
     return 0;
 }
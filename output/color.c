@@ -0,0 +1,126 @@
+#include "output/color.h"
+#include "util/err.h"
+#include <math.h>
+#include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static uint8_t apply_gamma(double x, double gamma) {
+    if (fabs(gamma - 1.) > 0.01)
+        x = pow(x / 255., gamma) * 255.;
+    return x;
+}
+
+struct output_color_lut {
+    struct output_color_lut * next;
+    int oversample;
+    double gamma;
+    int refs;
+    uint8_t table[];
+};
+
+static struct output_color_lut * luts = NULL;
+
+static struct output_color_lut * lut_acquire(int oversample, double gamma) {
+    if (fabs(gamma - 1.) <= 0.01) gamma = 1.; // apply_gamma() leaves these alone
+    for (struct output_color_lut * lut = luts; lut != NULL; lut = lut->next) {
+        if (lut->oversample == oversample && lut->gamma == gamma) {
+            lut->refs++;
+            return lut;
+        }
+    }
+
+    size_t length = 255 * 255 * oversample + 1;
+    struct output_color_lut * lut = malloc(sizeof *lut + length);
+    if (lut == NULL) MEMFAIL();
+    lut->oversample = oversample;
+    lut->gamma = gamma;
+    lut->refs = 1;
+    for (size_t i = 0; i < length; i++)
+        lut->table[i] = apply_gamma(i / (255. * oversample), gamma);
+    lut->next = luts;
+    luts = lut;
+    return lut;
+}
+
+static void lut_release(struct output_color_lut * lut) {
+    if (lut == NULL || --lut->refs > 0) return;
+    for (struct output_color_lut ** l = &luts; *l != NULL; l = &(*l)->next) {
+        if (*l == lut) {
+            *l = lut->next;
+            break;
+        }
+    }
+    free(lut);
+}
+
+void output_color_init(struct output_color * color, size_t n_pixels, int oversample, double gamma) {
+    color->oversample = oversample;
+    color->n_pixels = n_pixels;
+    color->shared = lut_acquire(oversample, gamma);
+    color->lut = color->shared->table;
+
+    color->premultiplied = malloc((n_pixels * 4 + 8) * sizeof *color->premultiplied);
+    if (color->premultiplied == NULL) MEMFAIL();
+}
+
+void output_color_term(struct output_color * color) {
+    lut_release(color->shared);
+    free(color->premultiplied);
+    memset(color, 0, sizeof *color);
+}
+
+// Every channel times its pixel's alpha; at most 255 * 255, so it fits in 16 bits
+static void premultiply(const SDL_Color * colors, size_t n_pixels, uint16_t * out) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 4 <= n_pixels; i += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i *) &colors[i]);
+        __m128i lo = _mm_unpacklo_epi8(pixels, zero);
+        __m128i hi = _mm_unpackhi_epi8(pixels, zero);
+        // Broadcast each pixel's alpha across its 4 lanes
+        __m128i lo_alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xFF), 0xFF);
+        __m128i hi_alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xFF), 0xFF);
+        _mm_storeu_si128((__m128i *) &out[4 * i], _mm_mullo_epi16(lo, lo_alpha));
+        _mm_storeu_si128((__m128i *) &out[4 * i + 8], _mm_mullo_epi16(hi, hi_alpha));
+    }
+#endif
+    for (; i < n_pixels; i++) {
+        out[4 * i + 0] = colors[i].r * colors[i].a;
+        out[4 * i + 1] = colors[i].g * colors[i].a;
+        out[4 * i + 2] = colors[i].b * colors[i].a;
+    }
+}
+
+unsigned long output_color_apply(struct output_color * color, const SDL_Color * colors, bool reverse, uint8_t * rgb) {
+    premultiply(colors, color->n_pixels, color->premultiplied);
+
+    size_t n_leds = color->n_pixels / color->oversample;
+    const uint16_t * in = color->premultiplied;
+    unsigned long energy = 0;
+    for (size_t l = 0; l < n_leds; l++) {
+        unsigned int r = 0, g = 0, b = 0;
+        for (int k = 0; k < color->oversample; k++) {
+            r += in[0];
+            g += in[1];
+            b += in[2];
+            in += 4;
+        }
+        uint8_t * out = &rgb[3 * (reverse ? n_leds - 1 - l : l)];
+        out[0] = color->lut[r];
+        out[1] = color->lut[g];
+        out[2] = color->lut[b];
+        energy += out[0] + out[1] + out[2];
+    }
+    return energy;
+}
+
+void output_color_scale(uint8_t * rgb, size_t length, double ratio) {
+    uint8_t lut[256];
+    for (int i = 0; i < 256; i++)
+        lut[i] = i * ratio;
+    for (size_t i = 0; i < length; i++)
+        rgb[i] = lut[rgb[i]];
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Turns a device's sampled colors into the RGB bytes sent to it:
+// premultiplies by alpha, sums every `oversample` pixels into one LED,
+// and maps the sum through a gamma table shared by every device with the
+// same oversample & gamma. Only used from the output thread.
+struct output_color_lut;
+
+struct output_color {
+    int oversample;
+    size_t n_pixels;
+    struct output_color_lut * shared;
+    const uint8_t * lut; // Indexed by the premultiplied sum, [0, 255 * 255 * oversample]
+    uint16_t * premultiplied; // Scratch space, 4 per pixel
+};
+
+void output_color_init(struct output_color * color, size_t n_pixels, int oversample, double gamma);
+void output_color_term(struct output_color * color);
+
+// Fill `rgb` with `n_pixels / oversample` LEDs from `colors`, last pixel first if `reverse`.
+// Returns the sum of the bytes written, for limiting energy
+unsigned long output_color_apply(struct output_color * color, const SDL_Color * colors, bool reverse, uint8_t * rgb);
+
+// Scale every byte of `rgb` by `ratio`, in [0, 1]
+void output_color_scale(uint8_t * rgb, size_t length, double ratio);
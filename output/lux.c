@@ -1,3 +1,6 @@
+#include <SDL2/SDL_thread.h>
+#include <SDL2/SDL_timer.h>
+
 #include "util/config.h"
 #include "util/string.h"
 #include "util/err.h"
@@ -5,11 +8,13 @@
 #include "output/lux.h"
 #include "output/slice.h"
 #include "output/config.h"
+#include "output/color.h"
 
 #define LUX_DEBUG INFO
 #include "liblux/lux.h"
 
 #define LUX_BROADCAST_ADDRESS 0xFFFFFFFF
+#define LUX_STAT_FRAMES 300 // Number of frames to average write times over
 
 enum lux_device_type {
     LUX_DEVICE_TYPE_STRIP,
@@ -20,12 +25,23 @@ enum lux_device_type {
 struct lux_channel;
 struct lux_device;
 
+// Each channel has its own writer thread, so that a slow or blocked
+// channel doesn't hold up the others. The output thread prepares every
+// device's frame, posts `frame_ready` on each channel, and waits for all
+// of them on `frame_done` before sending the syncs together.
 struct lux_channel {
     int fd;
     bool sync;
     int id;
     struct lux_channel * next;
     struct lux_device * device_head;
+
+    SDL_Thread * thread;
+    SDL_sem * frame_ready;
+    SDL_sem * frame_done;
+    volatile bool running;
+    Uint64 stat_write; // Time spent writing since the last stats
+    unsigned long stat_skipped; // Bytes of unchanged frames not sent since the last stats
 };
 
 struct lux_device {
@@ -38,6 +54,11 @@ struct lux_device {
     int length;
     size_t frame_buffer_size;
     uint8_t * frame_buffer;
+    bool frame_prepared; // `frame_buffer` holds this frame and is ready to write
+    struct output_color color;
+    uint64_t frame_hash; // Of the last frame sent
+    Uint32 frame_sent; // SDL_GetTicks() when it was sent
+    bool send_failed;
 
     double max_energy;
     int oversample;
@@ -45,6 +66,7 @@ struct lux_device {
 
     // Strip-only
     int strip_quantize;
+    uint8_t * quantize_buffer; // One RGB value per quantized segment
 
     // Spot-only
 
@@ -60,6 +82,7 @@ static struct lux_device * spot_devices = NULL;
 static size_t n_spot_devices = 0;
 static struct lux_device * grid_devices = NULL;
 static size_t n_grid_devices = 0;
+static int stat_frames = 0;
 
 //
 
@@ -165,6 +188,39 @@ static int lux_frame_sync (int fd, uint32_t lux_id) {
 
 //
 
+static void lux_channel_write_frame (struct lux_channel * channel, struct lux_device * devices, size_t n_devices,
+        int (*write_frame) (int fd, uint32_t lux_id, unsigned char * data, size_t data_size)) {
+    for (size_t i = 0; i < n_devices; i++) {
+        struct lux_device * device = &devices[i];
+        if (device->channel != channel || !device->frame_prepared) continue;
+        int rc = write_frame(
+                channel->fd,
+                device->address,
+                device->frame_buffer,
+                device->frame_buffer_size);
+        if (rc < 0) {
+            LOGLIMIT(WARN, "Unable to send frame to %#08x", device->address);
+            device->send_failed = true;
+        }
+    }
+}
+
+static int lux_channel_run (void * arg) {
+    struct lux_channel * channel = arg;
+    while (true) {
+        SDL_SemWait(channel->frame_ready);
+        if (!channel->running) break;
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        lux_channel_write_frame(channel, strip_devices, n_strip_devices, lux_strip_frame);
+        lux_channel_write_frame(channel, grid_devices, n_grid_devices, lux_grid_frame);
+        channel->stat_write += SDL_GetPerformanceCounter() - start;
+
+        SDL_SemPost(channel->frame_done);
+    }
+    return 0;
+}
+
 static struct lux_channel * lux_channel_create (const char * uri) {
     struct lux_channel * channel = calloc(1, sizeof *channel);
     if (channel == NULL) MEMFAIL();
@@ -176,6 +232,15 @@ static struct lux_channel * lux_channel_create (const char * uri) {
         return NULL;
     }
     channel->id = -1;
+
+    channel->frame_ready = SDL_CreateSemaphore(0);
+    channel->frame_done = SDL_CreateSemaphore(0);
+    if (channel->frame_ready == NULL || channel->frame_done == NULL)
+        FAIL("Could not create semaphore: %s\n", SDL_GetError());
+    channel->running = true;
+    channel->thread = SDL_CreateThread(&lux_channel_run, "Lux", channel);
+    if (channel->thread == NULL) FAIL("Could not create lux thread: %s\n", SDL_GetError());
+
     // Success!
     INFO("Initialized lux output channel '%s'", uri);
     channel->next = channel_head;
@@ -186,6 +251,11 @@ static struct lux_channel * lux_channel_create (const char * uri) {
 static void lux_channel_destroy_all() {
     struct lux_channel * channel = channel_head;
     while (channel != NULL) {
+        channel->running = false;
+        SDL_SemPost(channel->frame_ready);
+        SDL_WaitThread(channel->thread, NULL);
+        SDL_DestroySemaphore(channel->frame_ready);
+        SDL_DestroySemaphore(channel->frame_done);
         lux_close(channel->fd);
         struct lux_channel * prev_channel = channel;
         channel = channel->next;
@@ -195,64 +265,34 @@ static void lux_channel_destroy_all() {
 }
 
 //
-static uint8_t apply_gamma(double x, double gamma) {
-    if (fabs(gamma - 1.) > 0.01)
-        x = pow(x / 255., gamma) * 255.;
-    return x;
-}
-
 static int lux_strip_prepare_frame(struct lux_device * device) {
     if (device->frame_buffer == NULL ||
         device->base.pixels.colors == NULL) return -1;
 
-    uint8_t * frame_ptr = device->frame_buffer;
-    SDL_Color * pixel_ptr = device->base.pixels.colors + device->base.pixels.length - 1;
-#define PXL(x) apply_gamma((x) / (255. * device->oversample), device->gamma)
-
+    // Pixels run from the far end of the strip
+    unsigned long energy;
     if (device->strip_quantize > 0) {
-        int l = 0; 
+        output_color_apply(&device->color, device->base.pixels.colors, true, device->quantize_buffer);
+        energy = 0;
+        uint8_t * frame_ptr = device->frame_buffer;
+        int l = 0;
         for (int i = 0; i < device->strip_quantize; i++) {
-            unsigned int r = 0, g = 0, b = 0; 
-            for (int k = 0; k < device->oversample; k++) {
-                r += pixel_ptr->r * pixel_ptr->a;
-                g += pixel_ptr->g * pixel_ptr->a;
-                b += pixel_ptr->b * pixel_ptr->a;
-                pixel_ptr--;
-            }
+            const uint8_t * rgb = &device->quantize_buffer[3 * i];
             while (l * device->strip_quantize < (i+1) * device->length) {
-                *frame_ptr++ = PXL(r);
-                *frame_ptr++ = PXL(g);
-                *frame_ptr++ = PXL(b);
+                *frame_ptr++ = rgb[0];
+                *frame_ptr++ = rgb[1];
+                *frame_ptr++ = rgb[2];
+                energy += rgb[0] + rgb[1] + rgb[2];
                 l++;
             }
         }
     } else {
-        for (int l = 0; l < device->length; l++) {
-            unsigned int r = 0, g = 0, b = 0; 
-            for (int k = 0; k < device->oversample; k++) {
-                r += pixel_ptr->r * pixel_ptr->a;
-                g += pixel_ptr->g * pixel_ptr->a;
-                b += pixel_ptr->b * pixel_ptr->a;
-                pixel_ptr--;
-            }
-            *frame_ptr++ = PXL(r);
-            *frame_ptr++ = PXL(g);
-            *frame_ptr++ = PXL(b);
-        }
-    }
-#undef PXL
-
-    double energy = 0;
-    frame_ptr = device->frame_buffer;
-    for (size_t l = 0; l < device->frame_buffer_size; l++)
-        energy += *frame_ptr++;
-    energy /= device->frame_buffer_size * 255; 
-    if (energy > device->max_energy) {
-        double ratio = device->max_energy / energy;
-        frame_ptr = device->frame_buffer;
-        for (size_t l = 0; l < device->frame_buffer_size; l++)
-            *frame_ptr++ *= ratio;
+        energy = output_color_apply(&device->color, device->base.pixels.colors, true, device->frame_buffer);
     }
+
+    double energy_fraction = (double) energy / (device->frame_buffer_size * 255);
+    if (energy_fraction > device->max_energy)
+        output_color_scale(device->frame_buffer, device->frame_buffer_size, device->max_energy / energy_fraction);
     return 0;
 }
 
@@ -272,6 +312,8 @@ static void lux_device_term(struct lux_device * device) {
     //output_vertex_list_destroy(device->base.vertex_head);
     free(device->descriptor);
     free(device->frame_buffer);
+    free(device->quantize_buffer);
+    output_color_term(&device->color);
     //free(device->ui_name);
     if (device->base.prev != NULL)
         device->base.prev->next = device->base.next;
@@ -385,6 +427,11 @@ int output_lux_init() {
 
             device->frame_buffer = calloc(1, device->frame_buffer_size);
             if (device->frame_buffer == NULL) MEMFAIL();
+            if (device->strip_quantize > 0) {
+                device->quantize_buffer = calloc(3, device->strip_quantize);
+                if (device->quantize_buffer == NULL) MEMFAIL();
+            }
+            output_color_init(&device->color, device->base.pixels.length, device->oversample, device->gamma);
 
             output_device_arrange(&device->base);
         }
@@ -487,6 +534,7 @@ int output_lux_init() {
 
             device->frame_buffer = calloc(1, device->frame_buffer_size);
             if (device->frame_buffer == NULL) MEMFAIL();
+            output_color_init(&device->color, device->base.pixels.length, device->oversample, device->gamma);
 
             int rc = output_device_arrange_grid(&device->base, device->grid_width, device->grid_height);
             if (rc < 0)
@@ -500,54 +548,66 @@ int output_lux_init() {
     return 0;
 }
 
+// Skip frames that are the same as the last one sent, unless it is time for a keepalive
+static bool lux_frame_needs_send(struct lux_device * device) {
+    uint64_t hash = output_frame_hash(device->frame_buffer, device->frame_buffer_size);
+    Uint32 now = SDL_GetTicks();
+    if (output_config.lux.keepalive_ms > 0 && !device->send_failed && hash == device->frame_hash
+     && now - device->frame_sent < (Uint32) output_config.lux.keepalive_ms) {
+        device->channel->stat_skipped += device->frame_buffer_size;
+        return false;
+    }
+    device->frame_hash = hash;
+    device->frame_sent = now;
+    device->send_failed = false;
+    return true;
+}
+
 int output_lux_prepare_frame() {
-    int rc = 0; (void) rc;
     for (size_t i = 0; i < n_strip_devices; i++) {
         struct lux_device * device = &strip_devices[i];
         if (device->channel == NULL) continue;
-        rc = lux_strip_prepare_frame(device);
-        if (rc < 0) continue;
-        rc = lux_strip_frame(
-                device->channel->fd,
-                device->address,
-                device->frame_buffer,
-                device->frame_buffer_size);
-        if (rc < 0) LOGLIMIT(WARN, "Unable to send frame to %#08x", device->address);
+        device->frame_prepared = lux_strip_prepare_frame(device) >= 0 && lux_frame_needs_send(device);
     }
     /*
     for (size_t i = 0; i < n_spot_devices; i++) {
         struct lux_device * device = &spot_devices[i];
         if (device->channel == NULL) continue;
-        rc = lux_spot_prepare_frame(device);
-        if (rc < 0) continue;
-        rc = lux_spot_frame(
-                device->channel->fd,
-                device->address,
-                device->frame_buffer,
-                device->frame_buffer_size);
-        if (rc < 0) LOGLIMIT(WARN("Unable to send frame to %#08x", device->address));
+        device->frame_prepared = lux_spot_prepare_frame(device) >= 0;
     }
     */
     for (size_t i = 0; i < n_grid_devices; i++) {
         struct lux_device * device = &grid_devices[i];
         if (device->channel == NULL) continue;
-        rc = lux_grid_prepare_frame(device);
-        if (rc < 0) continue;
-        rc = lux_grid_frame(
-                device->channel->fd,
-                device->address,
-                device->frame_buffer,
-                device->frame_buffer_size);
-        if (rc < 0) LOGLIMIT(WARN, "Unable to send frame to %#08x", device->address);
+        device->frame_prepared = lux_grid_prepare_frame(device) >= 0 && lux_frame_needs_send(device);
     }
+
+    // Hand the frames over to the channel threads
+    for (struct lux_channel * channel = channel_head; channel; channel = channel->next)
+        SDL_SemPost(channel->frame_ready);
     return 0;
 }
 
 int output_lux_sync_frame() {
+    // Wait for every channel to finish writing, so that the syncs go out together
+    for (struct lux_channel * channel = channel_head; channel; channel = channel->next)
+        SDL_SemWait(channel->frame_done);
+
     for (struct lux_channel * channel = channel_head; channel; channel = channel->next) {
         if (!channel->sync) continue;
         int rc = lux_frame_sync(channel->fd, LUX_BROADCAST_ADDRESS);
         if (rc < 0) LOGLIMIT(WARN, "Unable to send sync message on fd %d", channel->fd);
     }
+
+    if (++stat_frames == LUX_STAT_FRAMES) {
+        for (struct lux_channel * channel = channel_head; channel; channel = channel->next) {
+            double write_ms = 1000. * channel->stat_write / SDL_GetPerformanceFrequency() / LUX_STAT_FRAMES;
+            DEBUG("Lux channel %d: writing %0.3f ms/frame; skipped %lu unchanged bytes/frame",
+                  channel->id, write_ms, channel->stat_skipped / LUX_STAT_FRAMES);
+            channel->stat_write = 0;
+            channel->stat_skipped = 0;
+        }
+        stat_frames = 0;
+    }
     return 0;
 }
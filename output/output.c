@@ -71,24 +71,22 @@ static int output_reload_devices() {
         }
     #endif
 
+    output_render_layout(render);
     return 0;
 }
 
 int output_run(void * args) {
     output_reload_devices();
 
-    /*
-    FPSmanager fps_manager;
-    SDL_initFramerate(&fps_manager);
-    SDL_setFramerate(&fps_manager, 100);
-    */
     double stat_ops = 100;
     int render_count = 0;
+    int stale_count = 0;
+    Uint64 stat_delay = 0;
+    int stat_delay_count = 0;
 
-    output_running = true;
     int last_tick = SDL_GetTicks();
-    unsigned int last_output_render_count = output_render_count;
-    (void) last_output_render_count; //TODO
+    Uint64 freq = SDL_GetPerformanceFrequency();
+    Uint64 last_send = 0;
 
     while(output_running) {
         if (output_refresh_request) {
@@ -96,10 +94,28 @@ int output_run(void * args) {
             output_refresh_request = 0;
         }
 
-        //if (last_output_render_count == output_render_count)
-        last_output_render_count = output_render_count;
+        // Sleep until there is a new frame, or until it's time to resend the last one
+        render_wait(render, config.output.keepalive_ms);
+        if (!output_running) break;
+
+        // Frames that arrive faster than max_fps wait here; the newest one is sent
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (config.output.max_fps > 0) {
+            Uint64 next = last_send + freq / config.output.max_fps;
+            if (now < next) {
+                SDL_Delay((next - now) * 1000 / freq);
+                now = SDL_GetPerformanceCounter();
+            }
+        }
+
         int rc = output_render(render);
         if (rc < 0) PERROR("Unable to render");
+        if (rc > 0) {
+            // Woken up without a new frame
+            if (config.output.keepalive_ms <= 0) continue;
+            if (now - last_send < (Uint64) config.output.keepalive_ms * freq / 1000) continue;
+            stale_count++;
+        }
 
         #ifdef RADIANCE_LUX
             if (output_on_lux) {
@@ -116,21 +132,25 @@ int output_run(void * args) {
             }
         #endif
 
-        //SDL_framerateDelay(&fps_manager);
-        SDL_Delay(1);
+        last_send = SDL_GetPerformanceCounter();
+        if (rc == 0) {
+            stat_delay += last_send - output_render_published;
+            stat_delay_count++;
+        }
+
         int tick = SDL_GetTicks();
         int delta = MAX(tick - last_tick, 1);
         stat_ops = INTERP(0.99, stat_ops, 1000. / delta);
-
-        if ((delta < 10) && (delta > 0)) {
-            SDL_Delay(10 - delta);
-            //LOGLIMIT(DEBUG, "Sleeping for %d ms", 10 - delta);
-        }
         last_tick = tick;
 
         render_count++;
-        if (render_count % 101 == 0)
-            DEBUG("Output FPS: %0.2f; delta=%d", stat_ops, delta);
+        if (render_count % 101 == 0) {
+            double delay_ms = stat_delay_count ? 1000. * stat_delay / freq / stat_delay_count : 0;
+            DEBUG("Output FPS: %0.2f; delta=%d; stale=%d; readback to send %0.2f ms", stat_ops, delta, stale_count, delay_ms);
+            stale_count = 0;
+            stat_delay = 0;
+            stat_delay_count = 0;
+        }
     }
 
     // Destroy output
@@ -140,6 +160,7 @@ int output_run(void * args) {
     #ifdef RADIANCE_PP
         if (output_on_pp) output_pp_term();
     #endif
+    output_render_term();
     output_config_del(&output_config);
 
     INFO("Output stopped");
@@ -150,14 +171,19 @@ void output_init(struct render * _render) {
     output_config_init(&output_config);
     render = _render;
 
+    // Set before the thread starts so that output_term() can't be missed
+    output_running = true;
     output_thread = SDL_CreateThread(&output_run, "Output", 0);
     if(!output_thread) FAIL("Could not create output thread: %s\n", SDL_GetError());
 }
 
 void output_term() {
     output_running = false;
+    render_wake(render);
+    SDL_WaitThread(output_thread, NULL);
 }
 
 void output_refresh() {
     output_refresh_request = true;
+    render_wake(render);
 }
@@ -28,6 +28,11 @@ static struct sockaddr_in out_addr;
 // the number of pixels per strip.
 static uint8_t * out_packet;
 
+// Bytes of unchanged packets not sent, averaged over PP_STAT_FRAMES
+#define PP_STAT_FRAMES 300
+static unsigned long stat_skipped = 0;
+static int stat_frames = 0;
+
 // See output_pp_do_frame for why we need this
 static struct timespec packet_interval = { .tv_sec = 0, .tv_nsec = 500*1000};
 
@@ -127,6 +132,10 @@ static int pp_add_grids() {
             device->base.active = false;
             return -1;
         }
+
+        output_color_init(&device->color, device->base.pixels.length, 1, 1.);
+        device->rgb = calloc(3, device->base.pixels.length);
+        if (device->rgb == NULL) MEMFAIL();
     }
 
     return 0;
@@ -181,6 +190,8 @@ void output_pp_term() {
         free(base.pixels.xs);
         free(base.pixels.ys);
         free(base.pixels.colors);
+        output_color_term(&grid_devices[i].color);
+        free(grid_devices[i].rgb);
 
         if (base.prev != NULL)
             base.prev->next = base.next;
@@ -211,6 +222,14 @@ int output_pp_do_frame() {
     // as we fill it.  The sequence number is 4 bytes so we start after that.
     size_t out_packet_idx = 4;
 
+    // Packets whose grids are all unchanged are skipped, up to `keepalive_ms`
+    Uint32 now = SDL_GetTicks();
+    Uint32 keepalive_ms = output_config.pixel_pusher.keepalive_ms;
+    struct pp_device * packet_devices[2];
+    uint64_t packet_hashes[2];
+    int n_packet_devices = 0;
+    bool packet_changed = false;
+
     for (size_t i = 0; i < n_grid_devices; i++) {
         struct pp_device * device = &grid_devices[i];
 
@@ -220,6 +239,7 @@ int output_pp_do_frame() {
         // Copy the data to send into a buffer - sadly SDL_Color is rgba
         // so we can't just send a header and it using sendmsg
         out_packet[out_packet_idx++] = device->strip_num;
+        output_color_apply(&device->color, device->base.pixels.colors, false, device->rgb);
 
         // Snake: The PixelPusher has linear strips arranged into a grid
         // by going "back and forth".
@@ -227,22 +247,39 @@ int output_pp_do_frame() {
             for (int k = 0; k < device->width; k++) {
                 int idx = (j % 2 ? device->width - 1 - k: k)*(device->height) + j;
 
-                SDL_Color color = device->base.pixels.colors[idx];
-                double alpha = color.a / 255.0;
-                out_packet[out_packet_idx++] = color.r * alpha;
-                out_packet[out_packet_idx++] = color.g * alpha;
-                out_packet[out_packet_idx++] = color.b * alpha;
+                memcpy(&out_packet[out_packet_idx], &device->rgb[3 * idx], 3);
+                out_packet_idx += 3;
             }
         }
 
+        uint64_t hash = output_frame_hash(device->rgb, 3 * device->base.pixels.length);
+        if (keepalive_ms == 0 || hash != device->frame_hash || now - device->frame_sent >= keepalive_ms)
+            packet_changed = true;
+        packet_hashes[n_packet_devices] = hash;
+        packet_devices[n_packet_devices++] = device;
+
         // Send it: the PixelPusher can take 2 grids per packet
         if ((i % 2) || (i == n_grid_devices - 1)) {
-            size_t sent_bytes = sendto(out_fd, out_packet, out_packet_idx, 0, (struct sockaddr *) &out_addr, sizeof out_addr);
-            if (sent_bytes < out_packet_idx) {
+            if (!packet_changed) {
+                stat_skipped += out_packet_idx - 4;
+                out_packet_idx = 4;
+                n_packet_devices = 0;
+                continue;
+            }
+            ssize_t sent_bytes = sendto(out_fd, out_packet, out_packet_idx, 0, (struct sockaddr *) &out_addr, sizeof out_addr);
+            if (sent_bytes < 0 || (size_t) sent_bytes < out_packet_idx) {
                 PERROR("Error sending PixelPusher data");
                 return -1;
             }
 
+            // Only a frame that made it out counts as sent
+            for (int j = 0; j < n_packet_devices; j++) {
+                packet_devices[j]->frame_hash = packet_hashes[j];
+                packet_devices[j]->frame_sent = now;
+            }
+            n_packet_devices = 0;
+            packet_changed = false;
+
             // The PixelPusher doesn't have a very large Ethernet buffer, and UDP doesn't resend things,
             // so if we don't give it some time to process it'll just drop any more incoming packets. The
             // symptom of this is only some of the grids will respond and the others will stay dark or
@@ -259,5 +296,10 @@ int output_pp_do_frame() {
         }
     }
 
+    if (++stat_frames == PP_STAT_FRAMES) {
+        DEBUG("PixelPusher: skipped %lu unchanged bytes/frame", stat_skipped / PP_STAT_FRAMES);
+        stat_skipped = 0;
+        stat_frames = 0;
+    }
     return 0;
 }
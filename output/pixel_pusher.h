@@ -3,6 +3,7 @@
 #include <stdint.h>
 
 #include "output/slice.h"
+#include "output/color.h"
 
 // https://github.com/robot-head/PixelPusher-python/blob/master/heroicrobot/pixelpusher/discovery.py
 // https://github.com/hzeller/rpi-matrix-pixelpusher/blob/master/universal-discovery-protocol.h
@@ -57,6 +58,11 @@ struct pp_device {
     int height;
 
     int strip_num;
+
+    struct output_color color; // Alpha premultiply only
+    uint8_t * rgb; // Premultiplied colors, before snaking
+    uint64_t frame_hash; // Of the last frame put in a packet
+    Uint32 frame_sent; // SDL_GetTicks() when it was last sent
 };
 
 int output_pp_init();
@@ -71,6 +71,22 @@ void output_vertex_list_destroy(struct output_vertex * head) {
 
 struct output_device * output_device_head = NULL;
 unsigned int output_render_count = 0;
+Uint64 output_render_published = 0;
+static unsigned int output_layout = 0;
+
+// Canvas byte offset of every active pixel, in device order; used when
+// the renderer reads back the whole canvas rather than sampling on the GPU
+static uint32_t * output_offsets = NULL;
+static size_t output_n_offsets = 0;
+
+uint64_t output_frame_hash(const uint8_t * data, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
 
 int output_device_arrange(struct output_device * dev) {
     size_t length = dev->pixels.length;
@@ -159,15 +175,65 @@ int output_device_arrange_grid(struct output_device * dev, int width, int height
     return 0;
 }
 
-int output_render(struct render * render) {
-    render_freeze(render);
+void output_render_layout(struct render * render) {
+    size_t n = 0;
+    for (struct output_device * dev = output_device_head; dev; dev = dev->next) {
+        if (dev->active) n += dev->pixels.length;
+    }
+
+    float * coords = malloc((2 * n + 1) * sizeof *coords);
+    if (coords == NULL) MEMFAIL();
+    output_offsets = realloc(output_offsets, (n + 1) * sizeof *output_offsets);
+    if (output_offsets == NULL) MEMFAIL();
+    output_n_offsets = n;
+
+    float * c = coords;
+    uint32_t * o = output_offsets;
     for (struct output_device * dev = output_device_head; dev; dev = dev->next) {
         if (!dev->active) continue;
-        for (size_t i = 0; i < dev->pixels.length; i++)
-            dev->pixels.colors[i] = render_sample(render, dev->pixels.xs[i], dev->pixels.ys[i]);
+        for (size_t i = 0; i < dev->pixels.length; i++) {
+            *c++ = dev->pixels.xs[i];
+            *c++ = dev->pixels.ys[i];
+            *o++ = render_sample_offset(dev->pixels.xs[i], dev->pixels.ys[i]);
+        }
+    }
+    output_layout = render_set_samples(render, coords, n);
+}
+
+int output_render(struct render * render) {
+    static unsigned long last_seq = 0;
+
+    const struct render_frame * frame = render_acquire(render);
+    if (frame->seq == 0) return 1; // Nothing rendered yet
+    int stale = frame->seq == last_seq;
+    last_seq = frame->seq;
+    output_render_published = frame->published;
+
+    if (render->sample_shader != 0) {
+        // Every pixel has already been sampled on the GPU, in device order
+        if (frame->layout != output_layout) return 1;
+        const SDL_Color * colors = (const SDL_Color *) frame->pixels;
+        for (struct output_device * dev = output_device_head; dev; dev = dev->next) {
+            if (!dev->active) continue;
+            memcpy(dev->pixels.colors, colors, dev->pixels.length * sizeof *colors);
+            colors += dev->pixels.length;
+        }
+    } else {
+        const uint32_t * offsets = output_offsets;
+        const uint32_t * end = output_offsets + output_n_offsets;
+        for (struct output_device * dev = output_device_head; dev; dev = dev->next) {
+            if (!dev->active) continue;
+            if ((size_t) (end - offsets) < dev->pixels.length) return 1; // Layout is out of date
+            render_gather(frame, offsets, dev->pixels.length, dev->pixels.colors);
+            offsets += dev->pixels.length;
+        }
     }
-    render_thaw(render);
     output_render_count++;
-    return 0;
+    return stale;
 }
 
+void output_render_term() {
+    free(output_offsets);
+    output_offsets = NULL;
+    output_n_offsets = 0;
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include <SDL2/SDL.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "ui/render.h"
 
 struct output_pixels {
@@ -38,10 +39,22 @@ struct output_device {
 
 extern struct output_device * output_device_head;
 extern unsigned int output_render_count;
+extern Uint64 output_render_published; // When the frame last rendered was read back
+
+// FNV-1a hash of a device's frame, to tell whether it needs sending again
+uint64_t output_frame_hash(const uint8_t * data, size_t length);
 
 // Calculate pixel coordinates from vertex coordinates
 int output_device_arrange(struct output_device * dev);
 int output_device_arrange_grid(struct output_device * dev, int width, int height);
 
-// Render all of the output device pixel buffers
+// Send the coordinates of every active pixel to the renderer
+// Must be called whenever devices are added, removed or re-arranged
+void output_render_layout(struct render * render);
+
+// Render all of the output device pixel buffers from the newest frame
+// Returns 1 if there was no new frame since the last call
 int output_render(struct render * render);
+
+// Free the sample offsets kept by output_render_layout()
+void output_render_term();
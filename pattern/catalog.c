@@ -0,0 +1,232 @@
+#include "pattern/catalog.h"
+#include "util/config.h"
+#include "util/err.h"
+#include "util/glsl.h"
+#include "util/string.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __LINUX__
+#include <sys/inotify.h>
+#endif
+
+static struct catalog_entry * entries = NULL;
+static int n_entries = 0;
+static int n_allocated = 0;
+
+#ifdef __LINUX__
+static int notify_fd = -1;
+static int pattern_wd = -1;
+static int image_wd = -1;
+#endif
+
+static struct catalog_entry * catalog_lookup(const char * name) {
+    for(int i = 0; i < n_entries; i++) {
+        if(strcmp(entries[i].name, name) == 0) return &entries[i];
+    }
+    return NULL;
+}
+
+static void catalog_entry_clear(struct catalog_entry * entry) {
+    for(int i = 0; i < entry->n_passes; i++) {
+        free(entry->sources[i]);
+    }
+    free(entry->sources);
+    free(entry->mtimes);
+    entry->sources = NULL;
+    entry->mtimes = NULL;
+    entry->n_passes = 0;
+    entry->image = false;
+}
+
+// Returns the pattern name if `filename` looks like `name.N.glsl`
+static char * catalog_pattern_name(const char * filename) {
+    size_t len = strlen(filename);
+    if(len < 7 || strcmp(filename + len - 5, ".glsl") != 0) return NULL;
+
+    size_t i = len - 5;
+    if(i == 0 || !isdigit((unsigned char) filename[i - 1])) return NULL;
+    while(i > 0 && isdigit((unsigned char) filename[i - 1])) i--;
+    if(i < 2 || filename[i - 1] != '.') return NULL;
+
+    char * name = strdup(filename);
+    if(name == NULL) MEMFAIL();
+    name[i - 1] = '\0';
+    return name;
+}
+
+// (Re)read everything about `name` from disk, dropping it if nothing is left
+static void catalog_load(const char * name) {
+    struct catalog_entry * entry = catalog_lookup(name);
+    if(entry == NULL) {
+        if(n_entries == n_allocated) {
+            n_allocated = n_allocated ? 2 * n_allocated : 64;
+            entries = realloc(entries, n_allocated * sizeof *entries);
+            if(entries == NULL) MEMFAIL();
+        }
+        entry = &entries[n_entries++];
+        memset(entry, 0, sizeof *entry);
+        entry->name = strdup(name);
+        if(entry->name == NULL) MEMFAIL();
+    } else {
+        catalog_entry_clear(entry);
+    }
+
+    for(;;) {
+        struct stat statbuf;
+        char * filename = rsprintf("%s%s.%d.glsl", config.pattern.dir, name, entry->n_passes);
+        if(filename == NULL) MEMFAIL();
+
+        if(stat(filename, &statbuf) != 0 || S_ISDIR(statbuf.st_mode)) {
+            free(filename);
+            break;
+        }
+        char * source = load_shader_source(filename);
+        free(filename);
+        if(source == NULL) {
+            WARN("%s", load_shader_error);
+            break;
+        }
+
+        int n = entry->n_passes + 1;
+        entry->sources = realloc(entry->sources, n * sizeof *entry->sources);
+        if(entry->sources == NULL) MEMFAIL();
+        entry->mtimes = realloc(entry->mtimes, n * sizeof *entry->mtimes);
+        if(entry->mtimes == NULL) MEMFAIL();
+        entry->sources[n - 1] = source;
+        entry->mtimes[n - 1] = statbuf.st_mtime;
+        entry->n_passes = n;
+    }
+
+    if(entry->n_passes == 0) {
+        struct stat statbuf;
+        char * filename = rsprintf("%s/%s", config.images.dir, name);
+        if(filename == NULL) MEMFAIL();
+        entry->image = stat(filename, &statbuf) == 0 && S_ISREG(statbuf.st_mode);
+        free(filename);
+    }
+
+    if(entry->n_passes == 0 && !entry->image) {
+        free(entry->name);
+        *entry = entries[--n_entries];
+    }
+}
+
+static void catalog_scan(const char * dir, bool images) {
+    DIR * d = opendir(dir);
+    if(d == NULL) {
+        ERROR("Could not open %s (%s)", dir, strerror(errno));
+        return;
+    }
+
+    struct dirent * ent;
+    while((ent = readdir(d)) != NULL) {
+        if(ent->d_name[0] == '.') continue;
+
+        char * name = images ? strdup(ent->d_name) : catalog_pattern_name(ent->d_name);
+        if(name == NULL) continue;
+        if(catalog_lookup(name) == NULL) catalog_load(name);
+        free(name);
+    }
+    closedir(d);
+}
+
+void catalog_init() {
+    catalog_scan(config.pattern.dir, false);
+    catalog_scan(config.images.dir, true);
+    INFO("Found %d patterns & images", n_entries);
+
+#ifdef __LINUX__
+    notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(notify_fd < 0) {
+        WARN("Could not watch for pattern changes (%s)", strerror(errno));
+        return;
+    }
+    uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE;
+    pattern_wd = inotify_add_watch(notify_fd, config.pattern.dir, mask);
+    image_wd = inotify_add_watch(notify_fd, config.images.dir, mask);
+    if(pattern_wd < 0 || image_wd < 0)
+        WARN("Could not watch for pattern changes (%s)", strerror(errno));
+#endif
+}
+
+void catalog_update() {
+#ifdef __LINUX__
+    if(notify_fd < 0) return;
+
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    for(;;) {
+        ssize_t len = read(notify_fd, buf, sizeof buf);
+        if(len <= 0) break;
+
+        for(char * ptr = buf; ptr < buf + len; ) {
+            const struct inotify_event * event = (const struct inotify_event *) ptr;
+            ptr += sizeof *event + event->len;
+            if(event->len == 0 || event->name[0] == '.') continue;
+
+            char * name = NULL;
+            if(event->wd == pattern_wd) {
+                name = catalog_pattern_name(event->name);
+            } else if(event->wd == image_wd) {
+                name = strdup(event->name);
+                if(name == NULL) MEMFAIL();
+            }
+            if(name == NULL) continue;
+
+            catalog_load(name);
+            DEBUG("Pattern '%s' changed on disk", name);
+            free(name);
+        }
+    }
+#endif
+}
+
+#ifndef __LINUX__
+// Whether any of the entry's passes changed on disk, or a pass was added
+static bool catalog_stale(const struct catalog_entry * entry) {
+    for(int i = 0; i <= entry->n_passes; i++) {
+        struct stat statbuf;
+        char * filename = rsprintf("%s%s.%d.glsl", config.pattern.dir, entry->name, i);
+        if(filename == NULL) MEMFAIL();
+        int rc = stat(filename, &statbuf);
+        free(filename);
+        if(i == entry->n_passes) return rc == 0;
+        if(rc != 0 || statbuf.st_mtime != entry->mtimes[i]) return true;
+    }
+    return false;
+}
+#endif
+
+const struct catalog_entry * catalog_find(const char * name) {
+    const struct catalog_entry * entry = catalog_lookup(name);
+#ifndef __LINUX__
+    // Without notifications, files are checked again when asked for
+    if(entry == NULL || (!entry->image && catalog_stale(entry))) {
+        catalog_load(name);
+        entry = catalog_lookup(name);
+    }
+#endif
+    return entry;
+}
+
+void catalog_term() {
+#ifdef __LINUX__
+    if(notify_fd >= 0) close(notify_fd);
+    notify_fd = -1;
+#endif
+    for(int i = 0; i < n_entries; i++) {
+        catalog_entry_clear(&entries[i]);
+        free(entries[i].name);
+    }
+    free(entries);
+    entries = NULL;
+    n_entries = 0;
+    n_allocated = 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Everything in config.pattern.dir and config.images.dir, read once at startup
+// and kept up to date from filesystem notifications (where available)
+struct catalog_entry {
+    char * name;
+
+    // Shader passes, `name.0.glsl` up to `name.<n_passes - 1>.glsl`
+    int n_passes;
+    char ** sources;
+    time_t * mtimes; // Checked by catalog_find() where there are no notifications
+
+    // Set when there are no shaders, but there is a file in the images dir
+    bool image;
+};
+
+void catalog_init();
+void catalog_term();
+
+// Picks up changes on disk; cheap enough to call every frame
+void catalog_update();
+
+// Returns NULL if there is no pattern or image with this name.
+// The entry is only valid until the next catalog_update()
+const struct catalog_entry * catalog_find(const char * name);
@@ -1,5 +1,7 @@
 #include "pattern/crossfader.h"
+#include "util/gl.h"
 #include "util/glsl.h"
+#include "util/texpool.h"
 #include "util/string.h"
 #include "util/err.h"
 #include "util/config.h"
@@ -11,79 +13,101 @@ void crossfader_init(struct crossfader * crossfader) {
     memset(crossfader, 0, sizeof *crossfader);
 
     crossfader->position = 0.5;
+    crossfader->left_deck = 0;
+    crossfader->right_deck = 1;
 
     crossfader->shader = load_shader("resources/crossfader.glsl");
     if(crossfader->shader == 0) FAIL("Unable to load crossfader shader:\n%s", load_shader_error);
+    if(pattern_sparse_enabled()) {
+        crossfader->sparse_shader = load_shader("resources/crossfader_sparse.glsl");
+        if(crossfader->sparse_shader == 0) FAIL("Unable to load sparse crossfader shader:\n%s", load_shader_error);
+    }
 
     // Render targets
-    glGenFramebuffersEXT(1, &crossfader->fb);
-    glGenTextures(1, &crossfader->tex_output);
-    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
-
-    glBindTexture(GL_TEXTURE_2D, crossfader->tex_output);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, config.pattern.master_width, config.pattern.master_height, 0, 
-                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenFramebuffers(1, &crossfader->fb);
+    crossfader->tex_output = texpool_get(config.pattern.master_width, config.pattern.master_height, GL_RGBA8);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, crossfader->fb);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D,
-                              crossfader->tex_output, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, crossfader->fb);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           crossfader->tex_output, 0);
     glClear(GL_COLOR_BUFFER_BIT);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 }
 
 void crossfader_term(struct crossfader * crossfader) {
     GLenum e;
 
-    glDeleteTextures(1, &crossfader->tex_output);
-    glDeleteFramebuffersEXT(1, &crossfader->fb);
-    glDeleteObjectARB(crossfader->shader);
+    texpool_put(crossfader->tex_output);
+    texpool_put(crossfader->tex_sparse);
+    glDeleteFramebuffers(1, &crossfader->fb);
+    gl_delete_program(crossfader->shader);
+    gl_delete_program(crossfader->sparse_shader);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
     memset(crossfader, 0, sizeof *crossfader);
 }
 
-void crossfader_render(struct crossfader * crossfader, GLuint left, GLuint right) {
+void crossfader_render(struct crossfader * crossfader, const struct deck * left, const struct deck * right,
+                       const struct pattern_sparse * sparse) {
     GLenum e;
-    glLoadIdentity();
-    glViewport(0, 0, config.pattern.master_width, config.pattern.master_height);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, crossfader->fb);
-    glUseProgramObjectARB(crossfader->shader);
+
+    crossfader->sparse = sparse != NULL && crossfader->sparse_shader != 0;
+    GLuint shader = crossfader->sparse ? crossfader->sparse_shader : crossfader->shader;
+    int width = config.pattern.master_width;
+    int height = config.pattern.master_height;
+    GLuint tex = crossfader->tex_output;
+    if(crossfader->sparse) {
+        width = sparse->width;
+        height = sparse->height;
+        int tex_width, tex_height;
+        texpool_size(crossfader->tex_sparse, &tex_width, &tex_height);
+        if(tex_width != width || tex_height != height) {
+            texpool_put(crossfader->tex_sparse);
+            crossfader->tex_sparse = texpool_get(width, height, GL_RGBA8);
+        }
+        tex = crossfader->tex_sparse;
+    }
+
+    glViewport(0, 0, width, height);
+    glBindFramebuffer(GL_FRAMEBUFFER, crossfader->fb);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           tex, 0);
+    glUseProgram(shader);
 
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, left);
+    glBindTexture(GL_TEXTURE_2D, left->tex_output);
     glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, right);
+    glBindTexture(GL_TEXTURE_2D, right->tex_output);
+    if(crossfader->sparse) {
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, sparse->coord_tex);
+        glUniform1i(gl_uniform(shader, "iCoords"), 2);
+        glUniform2f(gl_uniform(shader, "iCanvasResolution"), config.pattern.master_width, config.pattern.master_height);
+        glUniform1i(gl_uniform(shader, "iLeftSparse"), left->sparse);
+        glUniform1i(gl_uniform(shader, "iRightSparse"), right->sparse);
+    }
+    glActiveTexture(GL_TEXTURE0);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
     GLint loc;
-    loc = glGetUniformLocationARB(crossfader->shader, "iResolution");
-    glUniform2fARB(loc, config.pattern.master_width, config.pattern.master_height);
-    loc = glGetUniformLocationARB(crossfader->shader, "iIntensity");
-    glUniform1fARB(loc, crossfader->position);
-    loc = glGetUniformLocationARB(crossfader->shader, "iFrameLeft");
-    glUniform1iARB(loc, 0);
-    loc = glGetUniformLocationARB(crossfader->shader, "iFrameRight");
-    glUniform1iARB(loc, 1);
-    loc = glGetUniformLocationARB(crossfader->shader, "iLeftOnTop");
-    glUniform1iARB(loc, crossfader->left_on_top);
+    loc = gl_uniform(shader, "iResolution");
+    glUniform2f(loc, width, height);
+    loc = gl_uniform(shader, "iIntensity");
+    glUniform1f(loc, crossfader->position);
+    loc = gl_uniform(shader, "iFrameLeft");
+    glUniform1i(loc, 0);
+    loc = gl_uniform(shader, "iFrameRight");
+    glUniform1i(loc, 1);
+    loc = gl_uniform(shader, "iLeftOnTop");
+    glUniform1i(loc, crossfader->left_on_top);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
     glClear(GL_COLOR_BUFFER_BIT);
-    glBegin(GL_QUADS);
-    glVertex2d(-1, -1);
-    glVertex2d(-1, 1);
-    glVertex2d(1, 1);
-    glVertex2d(1, -1);
-    glEnd();
-
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    gl_fill();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
     if(crossfader->position == 1.) {
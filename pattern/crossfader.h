@@ -9,14 +9,26 @@
 struct crossfader {
     bool left_on_top;
 
-    GLhandleARB shader;
+    GLuint shader;
     GLuint tex_output;
     GLuint fb;
 
+    // Draws only the output pixels into tex_sparse; 0 unless pattern_sparse_enabled()
+    GLuint sparse_shader;
+    GLuint tex_sparse;
+    // Set when the last crossfader_render() drew tex_sparse rather than tex_output
+    bool sparse;
+
     float position;
+
+    // Decks shown on the left & right sides
+    int left_deck;
+    int right_deck;
     uint8_t * rb_buf;
 };
 
 void crossfader_init(struct crossfader * crossfader);
 void crossfader_term(struct crossfader * crossfader);
-void crossfader_render(struct crossfader * crossfader, GLuint left, GLuint right);
+// With `sparse`, only the output pixels are drawn
+void crossfader_render(struct crossfader * crossfader, const struct deck * left, const struct deck * right,
+                       const struct pattern_sparse * sparse);
@@ -4,6 +4,7 @@
 #include "util/string.h"
 #include "util/ini.h"
 #include "util/math.h"
+#include "util/texpool.h"
 #include <stdlib.h>
 #include <string.h>
 #define GL_GLEXT_PROTOTYPES
@@ -16,33 +17,66 @@ void deck_init(struct deck * deck) {
     memset(deck, 0, sizeof *deck);
     deck->pattern = calloc(config.deck.n_patterns, sizeof *deck->pattern);
     if(deck->pattern == NULL) MEMFAIL();
+    deck->pending = calloc(config.deck.n_patterns, sizeof *deck->pending);
+    if(deck->pending == NULL) MEMFAIL();
+    deck->pending_clear = calloc(config.deck.n_patterns, sizeof *deck->pending_clear);
+    if(deck->pending_clear == NULL) MEMFAIL();
+    deck->chain = calloc(config.deck.n_patterns, sizeof *deck->chain);
+    if(deck->chain == NULL) MEMFAIL();
 
-    glGenTextures(1, &deck->tex_input);
-    glGenFramebuffersEXT(1, &deck->fb_input);
+    deck->tex_input = texpool_get(config.pattern.master_width, config.pattern.master_height, GL_RGBA8);
+    glGenFramebuffers(1, &deck->fb_input);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
-    glBindTexture(GL_TEXTURE_2D, deck->tex_input);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, config.pattern.master_width, config.pattern.master_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
-
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, deck->fb_input);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D,
-                              deck->tex_input, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, deck->fb_input);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           deck->tex_input, 0);
     glClear(GL_COLOR_BUFFER_BIT);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 }
 
+// Drop the fused chains, which point at the current patterns
+static void deck_unfuse(struct deck * deck) {
+    for(int i = 0; i < config.deck.n_patterns; i++) {
+        if(deck->chain[i] != NULL) {
+            pattern_chain_term(deck->chain[i]);
+            free(deck->chain[i]);
+            deck->chain[i] = NULL;
+        }
+    }
+}
+
+// Start compiling a chain for every run of two or more pointwise patterns.
+// A single one is worth it too when it can be evaluated sparsely
+static void deck_fuse(struct deck * deck) {
+    deck_unfuse(deck);
+    int min_length = pattern_sparse_enabled() ? 1 : 2;
+
+    int start = 0;
+    for(int i = 0; i <= config.deck.n_patterns; i++) {
+        struct pattern * p = i < config.deck.n_patterns ? deck->pattern[i] : NULL;
+        // Chains render at the master resolution
+        if(p != NULL && p->pointwise && !p->persistent && p->scale == 1) continue;
+
+        if(i - start >= min_length) {
+            struct pattern_chain * chain = calloc(1, sizeof *chain);
+            if(chain == NULL) MEMFAIL();
+            if(pattern_chain_init(chain, &deck->pattern[start], i - start) == 0) {
+                deck->chain[start] = chain;
+            } else {
+                free(chain);
+            }
+        }
+        start = i + 1;
+    }
+}
+
 void deck_term(struct deck * deck) {
-    glDeleteTextures(1, &deck->tex_input);
-    glDeleteFramebuffersEXT(1, &deck->fb_input);
-    glDeleteTextures(1, &deck->tex_output);
+    deck_unfuse(deck);
+    texpool_put(deck->tex_input);
+    glDeleteFramebuffers(1, &deck->fb_input);
 
     for(int i = 0; i < config.deck.n_patterns; i++) {
         if(deck->pattern[i] != NULL) {
@@ -50,48 +84,105 @@ void deck_term(struct deck * deck) {
             free(deck->pattern[i]);
             deck->pattern[i] = NULL;
         }
+        if(deck->pending[i] != NULL) {
+            pattern_term(deck->pending[i]);
+            free(deck->pending[i]);
+            deck->pending[i] = NULL;
+        }
     }
+    free(deck->pattern);
+    free(deck->pending);
+    free(deck->pending_clear);
+    free(deck->chain);
     memset(deck, 0, sizeof *deck);
 }
 
-int deck_load_pattern(struct deck * deck, int slot, const char * prefix, float intensity) {
-    assert(slot >= 0 && slot < config.deck.n_patterns);
-    struct pattern * p = calloc(1, sizeof *p);
-
-    if(intensity < 0) {
-        if (deck->pattern[slot])
-            intensity = deck->pattern[slot]->intensity;
-        else
-            intensity = 0.;
+static void deck_drop_pending(struct deck * deck, int slot) {
+    if(deck->pending[slot]) {
+        pattern_term(deck->pending[slot]);
+        free(deck->pending[slot]);
+        deck->pending[slot] = NULL;
     }
+    deck->pending_clear[slot] = false;
+}
 
+int deck_load_pattern(struct deck * deck, int slot, const char * prefix, float intensity, float scale) {
+    assert(slot >= 0 && slot < config.deck.n_patterns);
+
+    // Reload what is in the slot, keeping a scale from the deck config unless a new one is given
     if(prefix[0] == '\0') {
-        if(deck->pattern[slot]) {
-            prefix = deck->pattern[slot]->name;
-        } else return -1;
+        const struct pattern * old = deck->pending[slot] ? deck->pending[slot] : deck->pattern[slot];
+        if(old == NULL) return -1;
+        prefix = old->name;
+        if(scale <= 0) scale = old->scale_override;
     }
 
-    int result = pattern_init(p, prefix);
+    struct pattern * p = calloc(1, sizeof *p);
+    if(p == NULL) MEMFAIL();
+
+    int result = pattern_init(p, prefix, scale);
     if(result != 0) {
         free(p);
         return result;
     }
-    if(deck->pattern[slot]) {
-        pattern_term(deck->pattern[slot]);
-        free(deck->pattern[slot]);
-    }
-    deck->pattern[slot] = p;
+
+    // The shaders are compiled in the background; the pattern is put
+    // in its slot by deck_render() once it is ready.
+    // A negative intensity is resolved then, from whatever the slot has.
+    deck_drop_pending(deck, slot);
+    deck->pending[slot] = p;
     p->intensity = intensity;
     return 0;
 }
 
 void deck_unload_pattern(struct deck * deck, int slot) {
     assert(slot >= 0 && slot < config.deck.n_patterns);
+    deck_drop_pending(deck, slot);
     if(deck->pattern[slot]) {
         pattern_term(deck->pattern[slot]);
         free(deck->pattern[slot]);
         deck->pattern[slot] = NULL;
+        deck_fuse(deck);
+    }
+}
+
+// Swap in the pending patterns once all of them have compiled
+static void deck_commit(struct deck * deck) {
+    bool staged = false;
+    for(int i = 0; i < config.deck.n_patterns; i++) {
+        if(deck->pending[i] != NULL) {
+            int rc = pattern_poll(deck->pending[i]);
+            if(rc == 0) return;
+            if(rc < 0) {
+                ERROR("Failed to load pattern '%s'", deck->pending[i]->name);
+                deck_drop_pending(deck, i);
+                continue;
+            }
+            staged = true;
+        }
+        if(deck->pending_clear[i]) staged = true;
+    }
+    if(!staged) return;
+
+    for(int i = 0; i < config.deck.n_patterns; i++) {
+        struct pattern * old = deck->pattern[i];
+        struct pattern * p = deck->pending[i];
+        if(p == NULL && !deck->pending_clear[i]) continue;
+
+        if(p != NULL) {
+            if(p->intensity < 0) p->intensity = old ? old->intensity : 0.;
+            p->preview = old ? old->preview : false;
+        }
+        if(old != NULL) {
+            pattern_term(old);
+            free(old);
+        }
+        deck->pattern[i] = p;
+        deck->pending[i] = NULL;
+        deck->pending_clear[i] = false;
     }
+    deck->swapped = true;
+    deck_fuse(deck);
 }
 
 struct deck_ini_data {
@@ -121,16 +212,21 @@ static int deck_ini_handler(void * user, const char * section, const char * name
         }
 
         char * name = strsep(&entry, ":");
-        float intensity = CLAMP(atof(entry), 0.0, 1.0);
+        char * intensity_text = strsep(&entry, ":");
+        float intensity = intensity_text != NULL ? CLAMP(atof(intensity_text), 0.0, 1.0) : 0.;
+        float scale = entry != NULL ? atof(entry) : 0.;
 
-        int rc =  deck_load_pattern(data->deck, slot++, name, intensity);
+        int rc =  deck_load_pattern(data->deck, slot++, name, intensity, scale);
         if (rc < 0) {
             WARN("Error loading pattern '%s'", name);
             break;
         }
     }
-    while (slot < config.deck.n_patterns)
-        deck_unload_pattern(data->deck, slot++);
+    // Empty the remaining slots together with the swap, not right away
+    while (slot < config.deck.n_patterns) {
+        deck_drop_pending(data->deck, slot);
+        data->deck->pending_clear[slot++] = true;
+    }
 
     free(val);
     return 1;
@@ -150,13 +246,117 @@ int deck_load_set(struct deck * deck, const char * name) {
     return rc;
 }
 
-void deck_render(struct deck * deck) {
+// Render the chain starting at `slot` in a single pass, sparsely when `sparse` is given.
+// Returns false when the patterns have to be rendered one at a time
+static bool deck_render_chain(struct deck * deck, int slot, int depth, const struct pattern_sparse * sparse) {
+    struct pattern_chain * chain = deck->chain[slot];
+
+    int rc = pattern_chain_poll(chain);
+    if(rc < 0) {
+        pattern_chain_term(chain);
+        free(chain);
+        deck->chain[slot] = NULL;
+        return false;
+    }
+    if(rc == 0) return false;
+
+    bool active[chain->n_patterns];
+    int n_active = 0;
+    int last = -1;
+    for(int i = 0; i < chain->n_patterns; i++) {
+        active[i] = slot + i < depth && chain->patterns[i]->intensity > 0;
+        if(active[i]) {
+            n_active++;
+            last = i;
+        }
+    }
+
+    // Nothing to gain unless it saves a pass, and the patterns before
+    // the last one have no output of their own to preview
+    bool fuse = sparse != NULL ? n_active >= 1 : n_active >= 2;
+    for(int i = 0; i < last; i++) {
+        if(chain->patterns[i]->preview) fuse = false;
+    }
+    if(!fuse) {
+        pattern_chain_release(chain);
+        return false;
+    }
+
+    pattern_chain_render(chain, active, deck->tex_output, deck->sparse, sparse);
+    deck->tex_output = chain->tex_output;
+    deck->version = chain->version;
+    deck->sparse = sparse != NULL;
+    deck->n_skipped += chain->n_patterns - n_active;
+    deck->n_fused += n_active - 1;
+    if(sparse != NULL) deck->n_sparse += n_active;
+    return true;
+}
+
+// The slot of the chain that can be evaluated sparsely, or -1.
+// That's when nothing is previewed and the chain covers the last pattern that renders
+static int deck_sparse_slot(const struct deck * deck, int depth) {
+    int last = -1;
+    for(int i = 0; i < config.deck.n_patterns; i++) {
+        struct pattern * p = deck->pattern[i];
+        if(p == NULL) continue;
+        if(p->preview) return -1;
+        if((i < depth && p->intensity > 0) || p->persistent) last = i;
+    }
+    if(last < 0) return -1;
+
+    for(int i = last; i >= 0; i--) {
+        struct pattern_chain * chain = deck->chain[i];
+        if(chain == NULL) continue;
+        if(i + chain->n_patterns <= last) return -1;
+        if(pattern_chain_poll(chain) != 1 || chain->sparse.shader == 0) return -1;
+        return i;
+    }
+    return -1;
+}
+
+void deck_render(struct deck * deck, const struct pattern_sparse * sparse) {
+    deck_commit(deck);
+
+    // Only the slots up to the last one whose output is seen anywhere matter
+    int depth = 0;
+    if(deck->output_needed) {
+        depth = config.deck.n_patterns;
+    } else {
+        for(int i = 0; i < config.deck.n_patterns; i++) {
+            if(deck->pattern[i] != NULL && deck->pattern[i]->preview) depth = i + 1;
+        }
+    }
+
     deck->tex_output = deck->tex_input;
+    deck->version = 0;
+    deck->sparse = false;
+    deck->n_skipped = 0;
+    deck->n_fused = 0;
+    deck->n_memoized = 0;
+    deck->n_sparse = 0;
+
+    int sparse_slot = sparse != NULL ? deck_sparse_slot(deck, depth) : -1;
 
     for(int i = 0; i < config.deck.n_patterns; i++) {
-        if(deck->pattern[i] != NULL) {
-            pattern_render(deck->pattern[i], deck->tex_output);
-            deck->tex_output = deck->pattern[i]->tex_output;
+        struct pattern * p = deck->pattern[i];
+        if(p == NULL) continue;
+
+        if(deck->chain[i] != NULL && deck_render_chain(deck, i, depth, i == sparse_slot ? sparse : NULL)) {
+            i += deck->chain[i]->n_patterns - 1;
+            continue;
+        }
+
+        if((i < depth && p->intensity > 0) || p->persistent) {
+            pattern_render(p, deck->tex_output, deck->version);
+            deck->tex_output = p->tex_output;
+            deck->version = p->version;
+            if(p->memoized) deck->n_memoized += p->n_shaders;
+        } else {
+            // Pass the input straight through, so it shows up in the preview too
+            pattern_release(p);
+            p->tex_output = deck->tex_output;
+            p->version = deck->version;
+            deck->n_skipped += p->n_shaders;
         }
     }
 }
@@ -174,6 +374,8 @@ int deck_save(const struct deck * deck, const char * name) {
     for (int i = 0; i < config.deck.n_patterns; i++) {
         if (deck->pattern[i] == NULL)
             rc = fprintf(f, " _");
+        else if (deck->pattern[i]->scale != 1)
+            rc = fprintf(f, " %s:%0.2f:%g", deck->pattern[i]->name, deck->pattern[i]->intensity, deck->pattern[i]->scale);
         else
             rc = fprintf(f, " %s:%0.2f", deck->pattern[i]->name, deck->pattern[i]->intensity);
         if (rc < 0) goto fail;
@@ -7,12 +7,44 @@ struct deck {
     GLuint tex_input;
     GLuint fb_input;
     GLuint tex_output;
+    // Version of tex_output, see `struct pattern`
+    unsigned long version;
+    // Set when tex_output only holds the output pixels, see `struct pattern_sparse`
+    bool sparse;
+
+    // Set each frame when the deck output is visible through the crossfader
+    bool output_needed;
+
+    // Number of shader passes skipped during the last deck_render()
+    int n_skipped;
+    // Number of shader passes saved by fusing patterns during the last deck_render()
+    int n_fused;
+    // Number of shader passes whose last output was reused during the last deck_render()
+    int n_memoized;
+    // Number of patterns evaluated only at the output pixels during the last deck_render()
+    int n_sparse;
+
+    // Runs of pointwise patterns compiled into one pass, indexed by the slot
+    // each run starts at. Rebuilt whenever the patterns change
+    struct pattern_chain ** chain;
+
+    // Patterns that are still compiling. The current patterns keep rendering
+    // until every pending one is ready, then they are all swapped in at once
+    struct pattern ** pending;
+    // Slots to empty when the pending patterns are swapped in
+    bool * pending_clear;
+    // Set when deck_render() swaps in pending patterns; cleared by the UI
+    bool swapped;
 };
 
 void deck_init(struct deck * deck);
 void deck_term(struct deck * deck);
-int deck_load_pattern(struct deck * deck, int slot, const char * prefix, float intensity);
+// A negative intensity keeps the slot's current one; a positive scale
+// overrides the pattern's own (see `struct pattern`)
+int deck_load_pattern(struct deck * deck, int slot, const char * prefix, float intensity, float scale);
 void deck_unload_pattern(struct deck * deck, int slot);
 int deck_load_set(struct deck * deck, const char * prefix);
-void deck_render(struct deck * deck);
+// With `sparse`, the patterns at the end of the deck may be evaluated at just the
+// output pixels, when nothing else needs their whole canvas
+void deck_render(struct deck * deck, const struct pattern_sparse * sparse);
 int deck_save(const struct deck * deck, const char * name);
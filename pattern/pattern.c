@@ -1,16 +1,21 @@
 #include "pattern/pattern.h"
+#include "pattern/catalog.h"
 #include "time/timebase.h"
+#include "util/gl.h"
 #include "util/glsl.h"
+#include "util/texpool.h"
 #include "util/string.h"
 #include "util/err.h"
 #include "util/config.h"
+#include "util/math.h"
 #include "main.h"
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
+#include <SDL2/SDL.h>
 #include <IL/il.h>
 #include <IL/ilu.h>
-#include <IL/ilut.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,97 +27,421 @@
 
 static bool il_initted = false;
 
-int pattern_init(struct pattern * pattern, const char * prefix) {
+// Layout of the `Globals` uniform block in header.glsl (std140)
+struct pattern_globals {
+    GLfloat time;
+    GLfloat audio_hi;
+    GLfloat audio_low;
+    GLfloat audio_mid;
+    GLfloat audio_level;
+    GLfloat fps;
+    GLfloat padding[2]; // std140 rounds the block up to a whole vec4
+};
+
+static struct pattern_globals globals;
+static GLuint globals_ubo = 0;
+static double frame_dt = 0;
+static unsigned long last_version = 0;
+
+void pattern_globals_init() {
     GLenum e;
 
-    memset(pattern, 0, sizeof *pattern);
+    if(config.render.compute && !gl_compute)
+        WARN("Compute shaders need OpenGL 4.3; rendering pointwise patterns with fragment shaders");
 
-    pattern->intensity = 0;
-    pattern->intensity_integral = 0;
-    pattern->name = strdup(prefix);
-    if(pattern->name == NULL) ERROR("Could not allocate memory");
+    if(!gl_core && !SDL_GL_ExtensionSupported("GL_ARB_uniform_buffer_object")) {
+        INFO("No uniform buffer support; pattern globals will be set per shader");
+        return;
+    }
+
+    glGenBuffers(1, &globals_ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, globals_ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof globals, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, PATTERN_GLOBALS_BINDING, globals_ubo);
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+}
+
+void pattern_globals_update(double dt, double fps) {
+    GLenum e;
+
+    frame_dt = dt;
+
+    globals.time = time_master.beat_frac + time_master.beat_index;
+    globals.audio_hi = audio_hi;
+    globals.audio_mid = audio_mid;
+    globals.audio_low = audio_low;
+    globals.audio_level = audio_level;
+    globals.fps = fps;
 
-    int n = 0;
-    for(;;) {
-        char * filename;
-        struct stat statbuf;
-        filename = rsprintf("%s%s.%d.glsl", config.pattern.dir, prefix, n);
-        if(filename == NULL) MEMFAIL();
+    if(globals_ubo != 0) {
+        glBindBuffer(GL_UNIFORM_BUFFER, globals_ubo);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof globals, &globals);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+    }
+}
 
-        int rc = stat(filename, &statbuf);
-        free(filename);
+void pattern_globals_term() {
+    if(globals_ubo != 0) glDeleteBuffers(1, &globals_ubo);
+    globals_ubo = 0;
+}
 
-        if (rc != 0 || S_ISDIR(statbuf.st_mode)) {
-            break;
+// Pick up `#pragma radiance ...` directives from a shader source
+static void pattern_read_directives(struct pattern * pattern, const char * source, int pass) {
+    const char * p = source;
+    while(*p != '\0') {
+        char line[256];
+        size_t len = strcspn(p, "\n");
+        size_t n = len < sizeof line - 1 ? len : sizeof line - 1;
+        memcpy(line, p, n);
+        line[n] = '\0';
+        p += len;
+        if(*p == '\n') p++;
+
+        char directive[64];
+        if(sscanf(line, " #pragma radiance %63s", directive) != 1) continue;
+
+        double scale;
+        if(strcmp(directive, "scale") == 0) {
+            if(sscanf(line, " #pragma radiance scale %lf", &scale) == 1 && scale > 0 && scale <= 1) {
+                pattern->scale = scale;
+            } else {
+                WARN("Expected a scale in (0, 1] in %s.%d.glsl", pattern->name, pass);
+            }
+        } else if(strcmp(directive, "persistent") == 0) {
+            pattern->persistent = true;
+        } else if(strcmp(directive, "pointwise") == 0) {
+            pattern->pointwise = true;
+        } else {
+            WARN("Unknown directive '%s' in %s.%d.glsl", directive, pattern->name, pass);
         }
-        n++;
     }
+}
 
-    if(n == 0) {
-        ERROR("Could not find any shaders for %s, trying to load an image", prefix);
+// Look up the uniforms shared by every pattern shader & set the ones that never change
+static void uniforms_init(GLuint h, struct pattern_uniforms * uni, int width, int height) {
+    if(globals_ubo != 0) {
+        GLuint block = glGetUniformBlockIndex(h, "Globals");
+        if(block != GL_INVALID_INDEX) glUniformBlockBinding(h, block, PATTERN_GLOBALS_BINDING);
+    }
+    uni->time = gl_uniform(h, "iTime");
+    uni->audio_hi = gl_uniform(h, "iAudioHi");
+    uni->audio_mid = gl_uniform(h, "iAudioMid");
+    uni->audio_low = gl_uniform(h, "iAudioLow");
+    uni->audio_level = gl_uniform(h, "iAudioLevel");
+    uni->fps = gl_uniform(h, "iFPS");
+
+    glUseProgram(h);
+    GLint loc;
+    loc = gl_uniform(h, "iResolution");
+    glUniform2f(loc, width, height);
+    loc = gl_uniform(h, "iFrame");
+    glUniform1i(loc, 0);
+    glUseProgram(0);
+}
 
-        // Now try to load an image
-        char * filename;
-        filename = rsprintf("%s/%s", config.images.dir, prefix);
-        if (filename == NULL) MEMFAIL();
+// Set the globals on the current program when they aren't in the uniform buffer
+static void uniforms_set_globals(const struct pattern_uniforms * uni) {
+    if(globals_ubo != 0) return;
+    glUniform1f(uni->time, globals.time);
+    glUniform1f(uni->audio_hi, globals.audio_hi);
+    glUniform1f(uni->audio_mid, globals.audio_mid);
+    glUniform1f(uni->audio_low, globals.audio_low);
+    glUniform1f(uni->audio_level, globals.audio_level);
+    glUniform1f(uni->fps, globals.fps);
+}
 
-        if (!il_initted) {
-            // See http://openil.sourceforge.net/docs/DevIL%20Manual.pdf for this sequence
-            ilInit();
-            iluInit();
-            ilutRenderer(ILUT_OPENGL);
+// Work out what the shader's output depends on from the uniforms the linker kept.
+// The globals are left to source_inputs(): every member of the Globals
+// uniform block counts as active, whether the shader uses it or not
+static unsigned int uniforms_inputs(GLuint h) {
+    unsigned int inputs = 0;
+    GLint n = 0;
+    glGetProgramiv(h, GL_ACTIVE_UNIFORMS, &n);
+    for(GLint i = 0; i < n; i++) {
+        char name[64];
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(h, i, sizeof name, NULL, &size, &type, name);
+
+        if(strcmp(name, "iIntensity") == 0) {
+            inputs |= PATTERN_INPUT_INTENSITY;
+        } else if(strcmp(name, "iIntensityIntegral") == 0) {
+            inputs |= PATTERN_INPUT_INTEGRAL;
+        } else if(strcmp(name, "iFrame") == 0) {
+            inputs |= PATTERN_INPUT_FRAME;
+        } else if(strncmp(name, "iChannel", 8) == 0) {
+            inputs |= PATTERN_INPUT_CHANNEL;
+        } else if(strcmp(name, "iImage") == 0) {
+            inputs |= PATTERN_INPUT_IMAGE;
+        }
+    }
+    return inputs;
+}
 
-            il_initted = true;
+static void pattern_uniforms_init(struct pattern * pattern, int i) {
+    GLuint h = pattern->shader[i];
+    struct pattern_uniforms * uni = &pattern->uni[i];
+
+    uniforms_init(h, uni, pattern->width, pattern->height);
+    uni->inputs = uniforms_inputs(h);
+    uni->intensity = gl_uniform(h, "iIntensity");
+    uni->intensity_integral = gl_uniform(h, "iIntensityIntegral");
+
+    glUseProgram(h);
+    GLint loc;
+    loc = gl_uniform(h, "iChannel");
+    glUniform1iv(loc, pattern->n_shaders, pattern->uni_tex);
+    loc = gl_uniform(h, "iImage");
+    glUniform1i(loc, pattern->n_shaders + 1);
+    glUseProgram(0);
+}
+
+// Growable string, for building shader sources
+struct source_buffer {
+    char * text;
+    size_t length;
+    size_t size;
+};
+
+static void source_append(struct source_buffer * buf, const char * text, size_t length) {
+    if(buf->length + length + 1 > buf->size) {
+        while(buf->length + length + 1 > buf->size) buf->size = buf->size ? 2 * buf->size : 1024;
+        buf->text = realloc(buf->text, buf->size);
+        if(buf->text == NULL) MEMFAIL();
+    }
+    memcpy(buf->text + buf->length, text, length);
+    buf->length += length;
+    buf->text[buf->length] = '\0';
+}
+
+static void source_appendf(struct source_buffer * buf, const char * fmt, int n) {
+    char text[64];
+    int length = snprintf(text, sizeof text, fmt, n);
+    assert(length > 0 && (size_t) length < sizeof text);
+    source_append(buf, text, length);
+}
+
+static bool is_identifier(char c) {
+    return isalnum((unsigned char) c) || c == '_';
+}
+
+static bool identifier_is(const char * p, size_t length, const char * name) {
+    return strlen(name) == length && strncmp(p, name, length) == 0;
+}
+
+// If `p` is the start of `texture2D(iFrame, ...)`, returns where the call ends
+static const char * skip_frame_sample(const char * p, size_t length) {
+    if(!identifier_is(p, length, "texture2D") && !identifier_is(p, length, "texture")) return NULL;
+    p += length;
+    while(isspace((unsigned char) *p)) p++;
+    if(*p++ != '(') return NULL;
+    while(isspace((unsigned char) *p)) p++;
+    if(strncmp(p, "iFrame", 6) != 0 || is_identifier(p[6])) return NULL;
+    p += 6;
+    while(isspace((unsigned char) *p)) p++;
+    if(*p != ',') return NULL;
+
+    int depth = 1;
+    for(; *p != '\0'; p++) {
+        if(*p == '(') depth++;
+        if(*p == ')' && --depth == 0) return p + 1;
+    }
+    return NULL;
+}
+
+// Rewrite a pointwise pattern as stage `stage` of a fused shader.
+// Its main() becomes pattern_stage<n>(), reading its input from iFusedFrame
+// and writing to iFusedColor, with its intensity taken from the stage's slot
+// in the iFused* arrays. When `sparse`, gl_FragCoord becomes the canvas
+// position of the output pixel being shaded. Returns NULL if the source uses
+// anything that only works in a pass of its own
+static char * pattern_fuse_source(const char * source, int stage, bool sparse) {
+    struct source_buffer buf = {0};
+    const char * p = source;
+    while(*p != '\0') {
+        if(isdigit((unsigned char) *p)) {
+            // Keep exponents like 1e-3 from looking like identifiers
+            const char * start = p;
+            while(is_identifier(*p) || *p == '.') p++;
+            source_append(&buf, start, p - start);
+            continue;
+        }
+        if(!is_identifier(*p)) {
+            source_append(&buf, p++, 1);
+            continue;
         }
 
-        // Give ourselves an image name to bind to.
-        ILuint image_info;
-        ilGenImages(1, &image_info);
-        ilBindImage(image_info);
+        const char * start = p;
+        while(is_identifier(*p)) p++;
+        size_t length = p - start;
+
+        const char * end = skip_frame_sample(start, length);
+        if(end != NULL) {
+            source_append(&buf, "iFusedFrame", 11);
+            p = end;
+        } else if(identifier_is(start, length, "main")) {
+            source_appendf(&buf, "pattern_stage%d", stage);
+        } else if(sparse && identifier_is(start, length, "gl_FragCoord")) {
+            source_append(&buf, "iSparseFragCoord", 16);
+        } else if(identifier_is(start, length, "gl_FragColor")) {
+            source_append(&buf, "iFusedColor", 11);
+        } else if(identifier_is(start, length, "iIntensity")) {
+            source_appendf(&buf, "iFusedIntensity[%d]", stage);
+        } else if(identifier_is(start, length, "iIntensityIntegral")) {
+            source_appendf(&buf, "iFusedIntensityIntegral[%d]", stage);
+        } else if(identifier_is(start, length, "iFrame")
+               || identifier_is(start, length, "iChannel")
+               || identifier_is(start, length, "iImage")) {
+            free(buf.text);
+            return NULL;
+        } else {
+            source_append(&buf, start, length);
+        }
+    }
+    return buf.text;
+}
 
-        if (!ilLoadImage(filename)) {
-            ERROR("Could not load image: %s", iluErrorString(ilGetError()));
-            free(filename);
-            return -1;
+// PATTERN_INPUT_GLOBALS if the source mentions any of the per-frame globals
+static unsigned int source_inputs(const char * source) {
+    const char * p = source;
+    while(*p != '\0') {
+        if(isdigit((unsigned char) *p)) {
+            while(is_identifier(*p) || *p == '.') p++;
+            continue;
+        }
+        if(!is_identifier(*p)) {
+            p++;
+            continue;
         }
 
-        pattern->n_frames = ilGetInteger(IL_NUM_IMAGES) + 1;
-        INFO("Found %d frames in image %s", pattern->n_frames, prefix);
+        const char * start = p;
+        while(is_identifier(*p)) p++;
+        size_t length = p - start;
+        if(identifier_is(start, length, "iTime") || identifier_is(start, length, "iFPS")
+           || (length > 6 && strncmp(start, "iAudio", 6) == 0)) {
+            return PATTERN_INPUT_GLOBALS;
+        }
+    }
+    return 0;
+}
+
+// Load every frame of an image into its own texture
+static int pattern_load_image(struct pattern * pattern, const char * prefix) {
+    char * filename;
+    filename = rsprintf("%s/%s", config.images.dir, prefix);
+    if (filename == NULL) MEMFAIL();
 
-        pattern->frames = calloc(pattern->n_frames, sizeof *pattern->frames);
+    if (!il_initted) {
+        // See http://openil.sourceforge.net/docs/DevIL%20Manual.pdf for this sequence
+        ilInit();
+        iluInit();
 
-        for (int i = 0; i < pattern->n_frames; i++) {
-            ILenum bindError;
+        il_initted = true;
+    }
 
-            // It's really important to call this each time or it has trouble loading frames (I suspect
-            // this is resetting a pointer into an array of frames somewhere)
-            ilBindImage(image_info);
+    // Give ourselves an image name to bind to.
+    ILuint image_info;
+    ilGenImages(1, &image_info);
+    ilBindImage(image_info);
 
-            if (ilActiveImage(i) == IL_FALSE) {
-                ERROR("Error setting active frame %d of image: %s", i, iluErrorString(ilGetError()));
+    if (!ilLoadImage(filename)) {
+        ERROR("Could not load image: %s", iluErrorString(ilGetError()));
+        goto fail;
+    }
 
-                return -1;
-            }
+    pattern->n_frames = ilGetInteger(IL_NUM_IMAGES) + 1;
+    INFO("Found %d frames in image %s", pattern->n_frames, prefix);
 
-            pattern->frames[i] = ilutGLBindTexImage();
+    pattern->frames = calloc(pattern->n_frames, sizeof *pattern->frames);
+    if(pattern->frames == NULL) MEMFAIL();
 
-            bindError = ilGetError();
+    for (int i = 0; i < pattern->n_frames; i++) {
+        ILenum bindError;
 
-            if (bindError != IL_NO_ERROR) {
-                ERROR("Error binding frame %d of image: %s", i, iluErrorString(bindError));
-                return -1;
-            }
+        // It's really important to call this each time or it has trouble loading frames (I suspect
+        // this is resetting a pointer into an array of frames somewhere)
+        ilBindImage(image_info);
+
+        if (ilActiveImage(i) == IL_FALSE) {
+            ERROR("Error setting active frame %d of image: %s", i, iluErrorString(ilGetError()));
+            goto fail;
+        }
+
+        // Upload it ourselves; ILUT's OpenGL support predates core profiles
+        if (ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE) == IL_FALSE) {
+            bindError = ilGetError();
+            ERROR("Error converting frame %d of image: %s", i, iluErrorString(bindError));
+            goto fail;
         }
 
-        INFO("Succcessfully loaded image %s", prefix);
+        glGenTextures(1, &pattern->frames[i]);
+        glBindTexture(GL_TEXTURE_2D, pattern->frames[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ilGetInteger(IL_IMAGE_WIDTH), ilGetInteger(IL_IMAGE_HEIGHT), 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, ilGetData());
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    INFO("Succcessfully loaded image %s", prefix);
+
+    // Now that it's been loaded into OpenGL delete it.
+    ilDeleteImages(1, &image_info);
 
-        // Now that it's been loaded into OpenGL delete it.
-        ilDeleteImages(1, &image_info);
+    pattern->current_frame = 0;
 
-        pattern->current_frame = 0;
+    free(filename);
+    return 0;
 
-        free(filename);
+fail:
+    ilDeleteImages(1, &image_info);
+    if(pattern->frames != NULL) {
+        glDeleteTextures(pattern->n_frames, pattern->frames);
+        free(pattern->frames);
+        pattern->frames = NULL;
+    }
+    free(filename);
+    return -1;
+}
+
+int pattern_init(struct pattern * pattern, const char * prefix, double scale) {
+    GLenum e;
 
+    memset(pattern, 0, sizeof *pattern);
+
+    pattern->intensity = 0;
+    pattern->intensity_integral = 0;
+    pattern->scale = 1;
+    pattern->name = strdup(prefix);
+    if(pattern->name == NULL) ERROR("Could not allocate memory");
+
+    const struct catalog_entry * entry = catalog_find(prefix);
+    if(entry == NULL) {
+        ERROR("No pattern or image named %s", prefix);
+        free(pattern->name);
+        pattern->name = NULL;
+        return -1;
+    }
+    int n = entry->n_passes;
+
+    if(entry->image) {
+        entry = catalog_find("image");
+        if(entry == NULL) {
+            ERROR("Could not find the image shader");
+            free(pattern->name);
+            pattern->name = NULL;
+            return -1;
+        }
+
+        if(pattern_load_image(pattern, prefix) != 0) {
+            free(pattern->name);
+            pattern->name = NULL;
+            return -1;
+        }
         n = 1;
     }
 
@@ -120,89 +449,143 @@ int pattern_init(struct pattern * pattern, const char * prefix) {
 
     pattern->shader = calloc(pattern->n_shaders, sizeof *pattern->shader);
     if(pattern->shader == NULL) MEMFAIL();
-    pattern->tex = calloc(pattern->n_shaders, sizeof *pattern->tex);
+    pattern->tex = calloc(pattern->n_shaders + 1, sizeof *pattern->tex);
     if(pattern->tex == NULL) MEMFAIL();
 
     bool success = true;
     for(int i = 0; i < pattern->n_shaders; i++) {
-        char * filename;
-        if (pattern->frames) {
-            filename = rsprintf("%simage.0.glsl", config.pattern.dir);
-        } else {
-            filename = rsprintf("%s%s.%d.glsl", config.pattern.dir, prefix, i);
-        }
-        if(filename == NULL) MEMFAIL();
-
-        GLhandleARB h = load_shader(filename);
+        GLuint h = load_shader_source_async(entry->sources[i]);
+        pattern_read_directives(pattern, entry->sources[i], i);
+        pattern->inputs |= source_inputs(entry->sources[i]);
 
         if (h == 0) {
             fprintf(stderr, "%s", load_shader_error);
-            WARN("Unable to load shader %s", filename);
+            WARN("Unable to load shader #%d of %s", i, prefix);
             success = false;
         } else {
             pattern->shader[i] = h;
-            DEBUG("Loaded shader #%d", i);
         }
-        free(filename);
     }
     if(!success) {
         ERROR("Failed to load some shaders.");
         return 2;
     }
 
+    if(pattern->pointwise) {
+        char * fused = pattern->n_shaders == 1 ? pattern_fuse_source(entry->sources[0], 0, false) : NULL;
+        if(fused == NULL) {
+            WARN("Ignoring `#pragma radiance pointwise` in %s: it needs a single pass that only reads iFrame", prefix);
+            pattern->pointwise = false;
+        } else {
+            pattern->source = strdup(entry->sources[0]);
+            if(pattern->source == NULL) MEMFAIL();
+        }
+        free(fused);
+    }
+
+    if(scale > 0) pattern->scale = pattern->scale_override = MIN(scale, 1.);
+    pattern->width = MAX((int) round(config.pattern.master_width * pattern->scale), 1);
+    pattern->height = MAX((int) round(config.pattern.master_height * pattern->scale), 1);
+    if(pattern->scale != 1) DEBUG("Rendering %s at %dx%d", prefix, pattern->width, pattern->height);
+
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
-    // Render targets
-    glGenFramebuffersEXT(1, &pattern->fb);
-    glGenTextures(pattern->n_shaders + 1, pattern->tex);
+    // Render targets come from the pool when the pattern is first rendered
+    glGenFramebuffers(1, &pattern->fb);
 
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
-    for(int i = 0; i < pattern->n_shaders + 1; i++) {
-        glBindTexture(GL_TEXTURE_2D, pattern->tex[i]);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, config.pattern.master_width, config.pattern.master_height, 0,
-                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    // Some OpenGL API garbage
+    pattern->uni_tex = calloc(pattern->n_shaders, sizeof *pattern->uni_tex);
+    if(pattern->uni_tex == NULL) MEMFAIL();
+    for(int i = 0; i < pattern->n_shaders; i++) {
+        pattern->uni_tex[i] = i + 1;
+    }
+
+    pattern->uni = calloc(pattern->n_shaders, sizeof *pattern->uni);
+    if(pattern->uni == NULL) MEMFAIL();
+
+    return 0;
+}
+
+int pattern_poll(struct pattern * pattern) {
+    GLenum e;
+
+    if(pattern->ready) return 1;
+
+    int status = 1;
+    for(int i = 0; i < pattern->n_shaders; i++) {
+        if(pattern->shader[i] == 0) return -1;
+        int rc = load_shader_poll(pattern->shader[i]);
+        if(rc < 0) {
+            fprintf(stderr, "%s", load_shader_error);
+            WARN("Unable to compile shader #%d of %s", i, pattern->name);
+            pattern->shader[i] = 0;
+            return -1;
+        }
+        if(rc == 0) status = 0;
     }
-    glBindTexture(GL_TEXTURE_2D, 0);
+    if(status == 0) return 0;
 
+    for(int i = 0; i < pattern->n_shaders; i++) {
+        pattern_uniforms_init(pattern, i);
+        pattern->inputs |= pattern->uni[i].inputs;
+        DEBUG("Loaded shader #%d", i);
+    }
+    if(!(pattern->inputs & (PATTERN_INPUT_GLOBALS | PATTERN_INPUT_CHANNEL)))
+        DEBUG("%s doesn't change on its own; its output is reused until its inputs change", pattern->name);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, pattern->fb);
+    pattern->ready = true;
+    return 1;
+}
+
+// Get render targets from the pool, starting from a blank slate
+static void pattern_acquire(struct pattern * pattern) {
+    GLenum e;
+
+    if(pattern->tex[0] != 0) return;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, pattern->fb);
     for(int i = 0; i < pattern->n_shaders + 1; i++) {
-        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D,
-                                  pattern->tex[i], 0);
+        pattern->tex[i] = texpool_get(pattern->width, pattern->height, GL_RGBA8);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                               pattern->tex[i], 0);
         glClear(GL_COLOR_BUFFER_BIT);
     }
+    pattern->flip = 0;
+    pattern->memo_valid = false;
 
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+}
 
-    // Some OpenGL API garbage
-    pattern->uni_tex = calloc(pattern->n_shaders, sizeof *pattern->uni_tex);
-    if(pattern->uni_tex == NULL) MEMFAIL();
-    for(int i = 0; i < pattern->n_shaders; i++) {
-        pattern->uni_tex[i] = i + 1;
+void pattern_release(struct pattern * pattern) {
+    if(pattern->tex == NULL) return;
+    pattern->memo_valid = false;
+    for(int i = 0; i < pattern->n_shaders + 1; i++) {
+        texpool_put(pattern->tex[i]);
+        pattern->tex[i] = 0;
     }
-
-    return 0;
 }
 
 void pattern_term(struct pattern * pattern) {
     GLenum e;
 
     for (int i = 0; i < pattern->n_shaders; i++) {
-        glDeleteObjectARB(pattern->shader[i]);
+        if(pattern->shader[i] != 0) gl_delete_program(pattern->shader[i]);
     }
 
-    glDeleteTextures(pattern->n_shaders + 1, pattern->tex);
-    glDeleteFramebuffersEXT(1, &pattern->fb);
+    pattern_release(pattern);
+    glDeleteFramebuffers(1, &pattern->fb);
 
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
     free(pattern->name);
+    free(pattern->source);
+    free(pattern->shader);
+    free(pattern->tex);
+    free(pattern->uni_tex);
+    free(pattern->uni);
 
     if (pattern->frames) {
         // Free the textures pointed to by the array
@@ -214,17 +597,27 @@ void pattern_term(struct pattern * pattern) {
     memset(pattern, 0, sizeof *pattern);
 }
 
-void pattern_render(struct pattern * pattern, GLuint input_tex) {
-    GLenum e;
+// Whether tex_output is still what the shaders would draw
+static bool pattern_memoized(const struct pattern * pattern, unsigned long input_version) {
+    unsigned int inputs = pattern->inputs;
+    if(!pattern->memo_valid) return false;
+    if(inputs & (PATTERN_INPUT_GLOBALS | PATTERN_INPUT_CHANNEL)) return false;
+    if((inputs & PATTERN_INPUT_INTENSITY) && pattern->intensity != pattern->memo_intensity) return false;
+    if((inputs & PATTERN_INPUT_INTEGRAL) && pattern->intensity_integral != pattern->memo_intensity_integral) return false;
+    if((inputs & PATTERN_INPUT_FRAME) && input_version != pattern->memo_input) return false;
+    if((inputs & PATTERN_INPUT_IMAGE) && pattern->current_frame != pattern->memo_frame) return false;
+    return true;
+}
 
-    glLoadIdentity();
-    glViewport(0, 0, config.pattern.master_width, config.pattern.master_height);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, pattern->fb);
+// Run every shader pass once
+static void pattern_draw(struct pattern * pattern, GLuint input_tex) {
+    GLenum e;
 
-    pattern->intensity_integral = fmod(pattern->intensity_integral + pattern->intensity / config.ui.fps, MAX_INTEGRAL);
+    glViewport(0, 0, pattern->width, pattern->height);
+    glBindFramebuffer(GL_FRAMEBUFFER, pattern->fb);
 
     for (int i = pattern->n_shaders - 1; i >= 0; i--) {
-        glUseProgramObjectARB(pattern->shader[i]);
+        glUseProgram(pattern->shader[i]);
 
         // Don't worry about this part.
         for(int j = 0; j < pattern->n_shaders; j++) {
@@ -232,49 +625,19 @@ void pattern_render(struct pattern * pattern, GLuint input_tex) {
             glActiveTexture(GL_TEXTURE1 + j);
             glBindTexture(GL_TEXTURE_2D, pattern->tex[(pattern->flip + j + (i < j)) % (pattern->n_shaders + 1)]);
         }
-        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D,
-                                  pattern->tex[(pattern->flip + i + 1) % (pattern->n_shaders + 1)], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                               pattern->tex[(pattern->flip + i + 1) % (pattern->n_shaders + 1)], 0);
 
         if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
-        GLint loc;
-        loc = glGetUniformLocationARB(pattern->shader[i], "iTime");
-        glUniform1fARB(loc, time_master.beat_frac + time_master.beat_index);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iAudioHi");
-        glUniform1fARB(loc, audio_hi);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iAudioMid");
-        glUniform1fARB(loc, audio_mid);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iAudioLow");
-        glUniform1fARB(loc, audio_low);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iAudioLevel");
-        glUniform1fARB(loc, audio_level);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iResolution");
-        glUniform2fARB(loc, config.pattern.master_width, config.pattern.master_height);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iIntensity");
-        glUniform1fARB(loc, pattern->intensity);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iIntensityIntegral");
-        glUniform1fARB(loc, pattern->intensity_integral);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iFPS");
-        glUniform1fARB(loc, config.ui.fps);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iFrame");
-        glUniform1iARB(loc, 0);
-        loc = glGetUniformLocationARB(pattern->shader[i], "iChannel");
-        glUniform1ivARB(loc, pattern->n_shaders, pattern->uni_tex);
+        struct pattern_uniforms * uni = &pattern->uni[i];
+        glUniform1f(uni->intensity, pattern->intensity);
+        glUniform1f(uni->intensity_integral, pattern->intensity_integral);
+        uniforms_set_globals(uni);
 
         if (pattern->frames) {
-            int texture_index = pattern->n_shaders + 1;
-            glActiveTexture(GL_TEXTURE0 + texture_index);
-
+            glActiveTexture(GL_TEXTURE0 + pattern->n_shaders + 1);
             glBindTexture(GL_TEXTURE_2D, pattern->frames[pattern->current_frame]);
-
-            loc = glGetUniformLocationARB(pattern->shader[i], "iImage");
-            glUniform1iARB(loc, texture_index);
-
-            // TODO: Should do something interesting off of beat_frac and beat_index
-            // to make the animation go faster/slower depending on the music
-            if (pattern->last_ms / RADIANCE_PATTERN_GIF_SPEED != time_master.wall_ms / RADIANCE_PATTERN_GIF_SPEED) {
-                pattern->current_frame = (pattern->current_frame + 1) % pattern->n_frames;
-            }
         }
 
         glActiveTexture(GL_TEXTURE0);
@@ -283,20 +646,277 @@ void pattern_render(struct pattern * pattern, GLuint input_tex) {
         if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
         glClear(GL_COLOR_BUFFER_BIT);
-        glBegin(GL_QUADS);
-        glVertex2d(-1, -1);
-        glVertex2d(-1, 1);
-        glVertex2d(1, 1);
-        glVertex2d(1, -1);
-        glEnd();
+        gl_fill();
 
         if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
     }
     pattern->flip = (pattern->flip + 1) % (pattern->n_shaders + 1);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
     pattern->tex_output = pattern->tex[pattern->flip];
+}
+
+void pattern_render(struct pattern * pattern, GLuint input_tex, unsigned long input_version) {
+    pattern_acquire(pattern);
 
-    pattern->last_ms = time_master.wall_ms;
+    pattern->intensity_integral = fmod(pattern->intensity_integral + pattern->intensity * frame_dt, MAX_INTEGRAL);
+
+    pattern->memoized = pattern_memoized(pattern, input_version);
+    if(!pattern->memoized) {
+        pattern_draw(pattern, input_tex);
+        pattern->version = ++last_version;
+        pattern->memo_valid = true;
+        pattern->memo_intensity = pattern->intensity;
+        pattern->memo_intensity_integral = pattern->intensity_integral;
+        pattern->memo_input = input_version;
+        pattern->memo_frame = pattern->current_frame;
+    }
+
+    if (pattern->frames) {
+        // TODO: Should do something interesting off of beat_frac and beat_index
+        // to make the animation go faster/slower depending on the music
+        pattern->frame_elapsed += frame_dt;
+        while (pattern->frame_elapsed >= RADIANCE_PATTERN_GIF_SPEED / 1000.) {
+            pattern->frame_elapsed -= RADIANCE_PATTERN_GIF_SPEED / 1000.;
+            pattern->current_frame = (pattern->current_frame + 1) % pattern->n_frames;
+        }
+    }
+}
+
+bool pattern_sparse_enabled() {
+    return config.render.sparse && config.render.sample_on_gpu && config.headless.enabled;
+}
+
+// Where each form of the fused shader gets its input and its gl_FragCoord
+static const char * fused_full_head =
+    "void main(void) {\n"
+    "    iFusedFrame = texture2D(iFrame, gl_FragCoord.xy / iResolution);\n";
+static const char * fused_sparse_head =
+    "uniform sampler2D iSparseCoords;\n"
+    "uniform vec2 iSparseResolution;\n"
+    "uniform bool iSparseInput;\n"
+    "vec4 iSparseFragCoord;\n"
+    "void main(void) {\n"
+    "    vec2 xy = texture2D(iSparseCoords, gl_FragCoord.xy / iSparseResolution).xy;\n"
+    "    vec2 uv = 0.5 * vec2(xy.x + 1., 1. - xy.y);\n"
+    "    // Snap to the nearest texel center, the same as sample.glsl\n"
+    "    iSparseFragCoord = vec4(clamp(floor(uv * iResolution), vec2(0.), iResolution - 1.) + 0.5, 0., 1.);\n"
+    "    if(iSparseInput) {\n"
+    "        iFusedFrame = texture2D(iFrame, gl_FragCoord.xy / iSparseResolution);\n"
+    "    } else {\n"
+    "        iFusedFrame = texture2D(iFrame, iSparseFragCoord.xy / iResolution);\n"
+    "    }\n";
+// The compute prelude in util/glsl.c points gl_FragCoord at iComputeFragCoord
+static const char * fused_compute_head =
+    "layout(rgba8) writeonly uniform image2D iOutput;\n"
+    "void main(void) {\n"
+    "    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);\n"
+    "    if(any(greaterThanEqual(texel, ivec2(iResolution)))) return;\n"
+    "    iComputeFragCoord = vec4(vec2(texel) + 0.5, 0., 1.);\n"
+    "    iFusedFrame = texture2D(iFrame, gl_FragCoord.xy / iResolution);\n";
+
+enum pattern_fused_form {
+    PATTERN_FUSED_FULL,
+    PATTERN_FUSED_SPARSE,
+    PATTERN_FUSED_COMPUTE,
+};
+
+static GLuint pattern_chain_compile(struct pattern ** patterns, int n_patterns, enum pattern_fused_form form) {
+    bool sparse = form == PATTERN_FUSED_SPARSE;
+    struct source_buffer buf = {0};
+    if(form == PATTERN_FUSED_COMPUTE) {
+        source_appendf(&buf, "layout(local_size_x = %d", PATTERN_COMPUTE_TILE);
+        source_appendf(&buf, ", local_size_y = %d) in;\n", PATTERN_COMPUTE_TILE);
+    }
+    source_appendf(&buf, "uniform bool iFusedActive[%d];\n", n_patterns);
+    source_appendf(&buf, "uniform float iFusedIntensity[%d];\n", n_patterns);
+    source_appendf(&buf, "uniform float iFusedIntensityIntegral[%d];\n", n_patterns);
+    const char * globals_source = "vec4 iFusedFrame;\nvec4 iFusedColor;\n";
+    source_append(&buf, globals_source, strlen(globals_source));
+    for(int i = 0; i < n_patterns; i++) {
+        source_appendf(&buf, "void pattern_stage%d(void);\n", i);
+    }
+
+    const char * main_head = fused_full_head;
+    if(form == PATTERN_FUSED_SPARSE) main_head = fused_sparse_head;
+    if(form == PATTERN_FUSED_COMPUTE) main_head = fused_compute_head;
+    source_append(&buf, main_head, strlen(main_head));
+    for(int i = 0; i < n_patterns; i++) {
+        // Clamp between stages like the RGBA8 target of a separate pass would
+        char text[128];
+        int length = snprintf(text, sizeof text,
+                              "    if(iFusedActive[%d]) { pattern_stage%d(); iFusedFrame = clamp(iFusedColor, 0., 1.); }\n", i, i);
+        source_append(&buf, text, length);
+    }
+    const char * main_end = "    gl_FragColor = iFusedFrame;\n}\n";
+    if(form == PATTERN_FUSED_COMPUTE) main_end = "    imageStore(iOutput, texel, iFusedFrame);\n}\n";
+    source_append(&buf, main_end, strlen(main_end));
+
+    for(int i = 0; i < n_patterns; i++) {
+        char * stage = patterns[i]->pointwise ? pattern_fuse_source(patterns[i]->source, i, sparse) : NULL;
+        if(stage == NULL) {
+            free(buf.text);
+            return 0;
+        }
+        source_append(&buf, stage, strlen(stage));
+        source_append(&buf, "\n", 1);
+        free(stage);
+    }
+
+    GLuint shader = form == PATTERN_FUSED_COMPUTE ? load_compute_source_async(buf.text) : load_shader_source_async(buf.text);
+    free(buf.text);
+    return shader;
+}
+
+int pattern_chain_init(struct pattern_chain * chain, struct pattern ** patterns, int n_patterns) {
+    GLenum e;
+
+    memset(chain, 0, sizeof *chain);
+
+    chain->full.shader = pattern_chain_compile(patterns, n_patterns, PATTERN_FUSED_FULL);
+    if(chain->full.shader == 0) return -1;
+    if(pattern_sparse_enabled()) chain->sparse.shader = pattern_chain_compile(patterns, n_patterns, PATTERN_FUSED_SPARSE);
+    if(config.render.compute && gl_compute) chain->compute.shader = pattern_chain_compile(patterns, n_patterns, PATTERN_FUSED_COMPUTE);
+
+    chain->patterns = malloc(n_patterns * sizeof *chain->patterns);
+    if(chain->patterns == NULL) MEMFAIL();
+    memcpy(chain->patterns, patterns, n_patterns * sizeof *chain->patterns);
+    chain->n_patterns = n_patterns;
+
+    glGenFramebuffers(1, &chain->fb);
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+    return 0;
+}
+
+// Same as load_shader_poll(), setting up the uniforms once it is linked
+static int pattern_fused_poll(struct pattern_fused * fused, const struct pattern_chain * chain) {
+    if(fused->shader == 0) return -1;
+
+    int rc = load_shader_poll(fused->shader);
+    if(rc < 0) {
+        // Usually two of the patterns define the same helper; they still work as separate passes
+        DEBUG("Could not fuse %d patterns starting with %s:\n%s",
+              chain->n_patterns, chain->patterns[0]->name, load_shader_error);
+        fused->shader = 0;
+        return -1;
+    }
+    if(rc == 0) return 0;
+
+    GLuint h = fused->shader;
+    uniforms_init(h, &fused->uni, config.pattern.master_width, config.pattern.master_height);
+    fused->uni.intensity = gl_uniform(h, "iFusedIntensity");
+    fused->uni.intensity_integral = gl_uniform(h, "iFusedIntensityIntegral");
+    fused->active = gl_uniform(h, "iFusedActive");
+    glUseProgram(h);
+    glUniform1i(gl_uniform(h, "iSparseCoords"), 1);
+    glUseProgram(0);
+    return 1;
+}
+
+int pattern_chain_poll(struct pattern_chain * chain) {
+    if(chain->ready) return 1;
+
+    int rc = pattern_fused_poll(&chain->full, chain);
+    if(rc <= 0) return rc;
+    // Without its sparse or compute form, the chain still renders the whole canvas
+    if(chain->sparse.shader != 0 && pattern_fused_poll(&chain->sparse, chain) == 0) return 0;
+    if(chain->compute.shader != 0 && pattern_fused_poll(&chain->compute, chain) == 0) return 0;
+
+    chain->ready = true;
+    return 1;
+}
+
+void pattern_chain_release(struct pattern_chain * chain) {
+    if(chain->tex_output != 0) texpool_put(chain->tex_output);
+    chain->tex_output = 0;
+}
+
+void pattern_chain_term(struct pattern_chain * chain) {
+    GLenum e;
+
+    if(chain->full.shader != 0) gl_delete_program(chain->full.shader);
+    if(chain->sparse.shader != 0) gl_delete_program(chain->sparse.shader);
+    if(chain->compute.shader != 0) gl_delete_program(chain->compute.shader);
+    pattern_chain_release(chain);
+    glDeleteFramebuffers(1, &chain->fb);
+
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+
+    free(chain->patterns);
+    memset(chain, 0, sizeof *chain);
+}
+
+void pattern_chain_render(struct pattern_chain * chain, const bool * active, GLuint input_tex,
+                          bool input_sparse, const struct pattern_sparse * sparse) {
+    GLenum e;
+
+    int n = chain->n_patterns;
+    GLint uni_active[n];
+    GLfloat intensity[n];
+    GLfloat intensity_integral[n];
+    for(int i = 0; i < n; i++) {
+        struct pattern * pattern = chain->patterns[i];
+        if(active[i]) {
+            pattern->intensity_integral = fmod(pattern->intensity_integral + pattern->intensity * frame_dt, MAX_INTEGRAL);
+        }
+        uni_active[i] = active[i];
+        intensity[i] = pattern->intensity;
+        intensity_integral[i] = pattern->intensity_integral;
+    }
+
+    int width = sparse ? sparse->width : config.pattern.master_width;
+    int height = sparse ? sparse->height : config.pattern.master_height;
+    // Switching between the canvas and the output pixels, or the output pixels changed
+    int tex_width, tex_height;
+    texpool_size(chain->tex_output, &tex_width, &tex_height);
+    if(tex_width != width || tex_height != height) pattern_chain_release(chain);
+    if(chain->tex_output == 0) chain->tex_output = texpool_get(width, height, GL_RGBA8);
+
+    const struct pattern_fused * fused = &chain->full;
+    if(sparse) fused = &chain->sparse;
+    else if(chain->compute.shader != 0) fused = &chain->compute;
+
+    glUseProgram(fused->shader);
+    glUniform1iv(fused->active, n, uni_active);
+    glUniform1fv(fused->uni.intensity, n, intensity);
+    glUniform1fv(fused->uni.intensity_integral, n, intensity_integral);
+    uniforms_set_globals(&fused->uni);
+
+    if(sparse) {
+        glUniform2f(gl_uniform(fused->shader, "iSparseResolution"), width, height);
+        glUniform1i(gl_uniform(fused->shader, "iSparseInput"), input_sparse);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, sparse->coord_tex);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, input_tex);
+
+    if(fused == &chain->compute) {
+        // One workgroup per tile; every stage stays in registers, with no framebuffer in between
+        glBindImageTexture(0, chain->tex_output, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+        glDispatchCompute((width + PATTERN_COMPUTE_TILE - 1) / PATTERN_COMPUTE_TILE,
+                          (height + PATTERN_COMPUTE_TILE - 1) / PATTERN_COMPUTE_TILE, 1);
+        // Whatever reads the output next samples it or reads it through a framebuffer
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+        glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+    } else {
+        glViewport(0, 0, width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, chain->fb);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                               chain->tex_output, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        gl_fill();
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+    chain->version = ++last_version;
+
+    // The patterns' own render targets aren't needed while they're fused
+    for(int i = 0; i < n; i++) {
+        pattern_release(chain->patterns[i]);
+        chain->patterns[i]->tex_output = chain->tex_output;
+        chain->patterns[i]->version = chain->version;
+    }
 }
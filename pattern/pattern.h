@@ -7,20 +7,92 @@
 
 #define MAX_INTEGRAL 1024
 
+// Milliseconds per frame of an animated image
 #define RADIANCE_PATTERN_GIF_SPEED 100
 
+// Uniform buffer binding point of the per-frame globals in header.glsl
+#define PATTERN_GLOBALS_BINDING 0
+
+// Width & height of the tiles compute shaders work through, one workgroup each
+#define PATTERN_COMPUTE_TILE 8
+
+// What the output of a pattern shader depends on, besides iResolution
+#define PATTERN_INPUT_GLOBALS   (1 << 0) // iTime, iAudio*, iFPS: change every frame
+#define PATTERN_INPUT_INTENSITY (1 << 1)
+#define PATTERN_INPUT_INTEGRAL  (1 << 2)
+#define PATTERN_INPUT_FRAME     (1 << 3)
+#define PATTERN_INPUT_CHANNEL   (1 << 4) // Its own last output: changes every frame
+#define PATTERN_INPUT_IMAGE     (1 << 5)
+
+// Uniform locations of a pattern shader, looked up once when it is loaded
+struct pattern_uniforms {
+    // PATTERN_INPUT_* flags for the uniforms the linked shader actually uses,
+    // apart from the globals (see `pattern.inputs`)
+    unsigned int inputs;
+
+    // Only used when the globals can't go through a uniform buffer
+    GLint time;
+    GLint audio_hi;
+    GLint audio_mid;
+    GLint audio_low;
+    GLint audio_level;
+    GLint fps;
+
+    GLint intensity;
+    GLint intensity_integral;
+};
+
 struct pattern {
-    GLhandleARB * shader;
+    GLuint * shader;
     int n_shaders;
     char * name;
     double intensity;
     double intensity_integral;
 
+    // Set by `#pragma radiance persistent`: keep rendering even when the
+    // output isn't used, so that feedback state in iChannel keeps evolving
+    bool persistent;
+
+    // Set by `#pragma radiance pointwise` on a single-pass pattern that only
+    // reads iFrame at its own pixel, so it can be fused with its neighbours
+    bool pointwise;
+    // Kept for pattern_chain_init() when the pattern is pointwise
+    char * source;
+
+    // Fraction of the master resolution the pattern renders at, from
+    // `#pragma radiance scale <s>` or the deck config. Whatever reads the
+    // output upsamples it bilinearly
+    double scale;
+    double scale_override; // The scale from the deck config, or 0 if there was none
+    int width;
+    int height;
+
+    // Set each frame when the output is shown in the UI
+    bool preview;
+
+    // Set by pattern_poll() once every shader has finished compiling
+    bool ready;
+
     int flip;
     GLuint * tex;
     GLuint fb;
     GLint * uni_tex;
+    struct pattern_uniforms * uni;
     GLuint tex_output;
+    // Identifies what is in tex_output; every pass drawn anywhere gets a new one.
+    // Version 0 is the blank input of a deck
+    unsigned long version;
+
+    // Inputs of all of the shaders together; the globals are found from the sources
+    unsigned int inputs;
+    // What tex_output was last drawn from, so it can be reused while nothing changes
+    bool memo_valid;
+    double memo_intensity;
+    double memo_intensity_integral;
+    unsigned long memo_input;
+    int memo_frame;
+    // Set by pattern_render() when it reused the last output
+    bool memoized;
 
     // We don't actually need both of these ints as given
     // the current frame you can compute the start of the image
@@ -30,10 +102,71 @@ struct pattern {
     int current_frame;
     GLuint * frames;
 
-    // The last time_master.wall_ms we were rendered at
-    long last_ms;
+    // How long the current frame has been shown, in seconds
+    double frame_elapsed;
 };
 
-int pattern_init(struct pattern * pattern, const char * prefix);
+// Per-frame globals shared by every pattern
+void pattern_globals_init();
+// `dt` is the measured time since the last frame, `fps` the measured frame rate
+void pattern_globals_update(double dt, double fps);
+void pattern_globals_term();
+
+// Starts compiling the pattern's shaders; poll until it is ready before rendering.
+// A positive `scale` overrides the one the pattern declares
+int pattern_init(struct pattern * pattern, const char * prefix, double scale);
+// Returns 1 when the pattern can be rendered, 0 while it is compiling, -1 on failure
+int pattern_poll(struct pattern * pattern);
 void pattern_term(struct pattern * pattern);
-void pattern_render(struct pattern * pattern, GLuint input_tex);
+// Hand the render targets back to the pool; they are picked up again when rendering
+void pattern_release(struct pattern * pattern);
+// `input_version` is the version of input_tex, see `struct pattern`
+void pattern_render(struct pattern * pattern, GLuint input_tex, unsigned long input_version);
+
+// Output pixel positions, one per texel, for rendering only what the output samples.
+// A "sparse" texture holds one color per output pixel in the same layout
+struct pattern_sparse {
+    GLuint coord_tex; // (x, y) device coordinates
+    int width;
+    int height;
+};
+
+// One compiled form of a pattern chain
+struct pattern_fused {
+    GLuint shader;
+    struct pattern_uniforms uni; // intensity & intensity_integral are arrays
+    GLint active;
+};
+
+// Pointwise patterns in consecutive deck slots, compiled into a single shader
+// so the whole run takes one pass instead of one per pattern
+struct pattern_chain {
+    struct pattern ** patterns; // Owned by the deck
+    int n_patterns;
+
+    struct pattern_fused full; // Shades the whole canvas
+    struct pattern_fused sparse; // Shades only the output pixels; 0 when unavailable
+    struct pattern_fused compute; // Replaces `full` with `config.render.compute`; 0 when unavailable
+    bool ready;
+
+    GLuint fb;
+    GLuint tex_output;
+    unsigned long version;
+};
+
+// Whether chains get a sparse form at all: only headless runs ever use it,
+// since the UI shows whole canvases
+bool pattern_sparse_enabled();
+
+// Starts compiling the fused shaders; returns -1 if the patterns can't be fused
+int pattern_chain_init(struct pattern_chain * chain, struct pattern ** patterns, int n_patterns);
+// Same as pattern_poll()
+int pattern_chain_poll(struct pattern_chain * chain);
+void pattern_chain_term(struct pattern_chain * chain);
+void pattern_chain_release(struct pattern_chain * chain);
+// Render the patterns flagged in `active`; the others pass their input through.
+// Every pattern's output becomes the output of the chain.
+// With `sparse`, only the output pixels are shaded into a sparse texture;
+// `input_sparse` says whether input_tex is one too, or a whole canvas
+void pattern_chain_render(struct pattern_chain * chain, const bool * active, GLuint input_tex,
+                          bool input_sparse, const struct pattern_sparse * sparse);
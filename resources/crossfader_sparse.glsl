@@ -0,0 +1,36 @@
+// The crossfader, evaluated only at the location of every output pixel (see sample.glsl)
+// Each deck's output is either a whole canvas, or already holds one texel per output pixel
+
+uniform sampler2D iCoords;
+uniform vec2 iCanvasResolution;
+uniform bool iLeftSparse;
+uniform bool iRightSparse;
+
+vec4 fetch(sampler2D frame, bool sparse, vec2 canvas_uv) {
+    if(sparse) return texture2D(frame, gl_FragCoord.xy / iResolution);
+    return texture2D(frame, canvas_uv);
+}
+
+void main(void) {
+    vec2 xy = texture2D(iCoords, gl_FragCoord.xy / iResolution).xy;
+    vec2 uv = 0.5 * vec2(xy.x + 1., 1. - xy.y);
+
+    // Snap to the nearest texel center, the same as render_sample()
+    vec2 texel = clamp(floor(uv * iCanvasResolution), vec2(0.), iCanvasResolution - 1.);
+    vec2 canvas_uv = (texel + 0.5) / iCanvasResolution;
+
+    float left_alpha = min((1. - iIntensity) * 2., 1.);
+    float right_alpha = min(iIntensity * 2., 1.);
+
+    vec4 left = fetch(iFrameLeft, iLeftSparse, canvas_uv);
+    vec4 right = fetch(iFrameRight, iRightSparse, canvas_uv);
+
+    left.a *= left_alpha;
+    right.a *= right_alpha;
+
+    if(iLeftOnTop) {
+        gl_FragColor = composite(right, left);
+    } else {
+        gl_FragColor = composite(left, right);
+    }
+}
@@ -1,13 +1,30 @@
-#version 120
+// util/glsl.c puts the #version line (and anything needed to build on either GL profile) above this
+
+// Values that are the same for every pattern are uploaded once per frame
+// into a shared uniform buffer when the driver supports it
+#if defined(GL_ARB_uniform_buffer_object) || __VERSION__ >= 140
+#define GLOBAL
+layout(std140) uniform Globals {
+#else
+#define GLOBAL uniform
+#endif
 
 // Time, measured in beats. Wraps around to 0 every 16 beats, [0.0, 16.0)
-uniform float iTime;
+GLOBAL float iTime;
 
 // Audio levels, high/mid/low/level, [0.0, 1.0]
-uniform float iAudioHi;
-uniform float iAudioLow;
-uniform float iAudioMid;
-uniform float iAudioLevel;
+GLOBAL float iAudioHi;
+GLOBAL float iAudioLow;
+GLOBAL float iAudioMid;
+GLOBAL float iAudioLevel;
+
+// Measured engine frame rate, smoothed
+GLOBAL float iFPS;
+
+#if defined(GL_ARB_uniform_buffer_object) || __VERSION__ >= 140
+};
+#endif
+#undef GLOBAL
 
 // Resolution of the output pattern
 uniform vec2 iResolution;
@@ -18,9 +35,6 @@ uniform float iIntensity;
 // Intensity slider integrated with respect to wall time mod 1024, [0.0, 1024.0)
 uniform float iIntensityIntegral;
 
-// (Ideal) output rate in frames per second
-uniform float iFPS;
-
 // Output of the previous pattern
 uniform sampler2D iFrame;
 
@@ -142,11 +156,7 @@ uniform sampler2D iFrameRight;
 uniform sampler2D iPreview;
 uniform sampler2D iStrips;
 uniform sampler2D iTexture;
-uniform sampler2D iText;
-uniform sampler2D iName;
 uniform vec2 iPosition;
-uniform vec2 iTextResolution;
-uniform vec2 iNameResolution;
 
 float rounded_rect_df(vec2 center, vec2 size, float radius) {
     return length(max(abs(gl_FragCoord.xy - center) - size, 0.0)) - radius;
@@ -1,4 +1,5 @@
 // Reduce alpha
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
@@ -1,4 +1,5 @@
 // Full black strobe. Intensity increases frequency
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
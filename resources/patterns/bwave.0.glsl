@@ -1,4 +1,5 @@
 // Black sine wave from left to right.
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
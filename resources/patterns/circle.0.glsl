@@ -1,4 +1,5 @@
 // Yellow blob that spins to the beat
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
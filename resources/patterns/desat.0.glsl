@@ -1,4 +1,5 @@
 // Desaturate (make white)
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
@@ -1,4 +1,5 @@
 // Fake edge detection based only on alpha
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
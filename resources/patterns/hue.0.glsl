@@ -1,4 +1,5 @@
 // Shift the color in HSV space
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
@@ -1,4 +1,5 @@
 // Smooth output
+#pragma radiance persistent
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
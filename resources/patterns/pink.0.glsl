@@ -1,4 +1,5 @@
 // Pink polka dots
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
@@ -1,4 +1,5 @@
 // Big purple soft circle 
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
@@ -1,4 +1,5 @@
 // Cycle the color (in HSV) over time
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
@@ -1,4 +1,5 @@
 // Change the color (in HSV) to red
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
@@ -1,4 +1,5 @@
 // Recolor output with noise rainbow
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
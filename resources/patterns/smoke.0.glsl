@@ -1,4 +1,5 @@
 // Perlin noise green smoke
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
@@ -1,4 +1,5 @@
 // Per-pixel twinkle effect
+#pragma radiance persistent
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
@@ -1,4 +1,5 @@
 // White slit for testing
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
@@ -1,4 +1,5 @@
 // Only update a vertical slice that slides across
+#pragma radiance persistent
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
@@ -1,4 +1,5 @@
 // Blue vertical VU meter
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
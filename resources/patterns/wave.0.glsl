@@ -1,4 +1,5 @@
 // Green and blue base pattern
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
@@ -1,4 +1,5 @@
 // White wave with hard edges
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
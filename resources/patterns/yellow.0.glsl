@@ -1,4 +1,5 @@
 // Yellow and green vertical waves
+#pragma radiance pointwise
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
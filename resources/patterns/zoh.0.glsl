@@ -1,4 +1,5 @@
 // Zero order hold to the beat
+#pragma radiance persistent
 
 void main(void) {
     vec2 uv = gl_FragCoord.xy / iResolution;
@@ -0,0 +1,14 @@
+// Samples the output canvas at the location of every output pixel
+// Each texel of iCoords holds the (x, y) device coordinates of one pixel
+
+uniform sampler2D iCoords;
+uniform vec2 iCanvasResolution;
+
+void main(void) {
+    vec2 xy = texture2D(iCoords, gl_FragCoord.xy / iResolution).xy;
+    vec2 uv = 0.5 * vec2(xy.x + 1., 1. - xy.y);
+
+    // Snap to the nearest texel center, the same as render_sample()
+    vec2 texel = clamp(floor(uv * iCanvasResolution), vec2(0.), iCanvasResolution - 1.);
+    gl_FragColor = texture2D(iFrame, (texel + 0.5) / iCanvasResolution);
+}
@@ -0,0 +1,8 @@
+// One instance per output pixel; iVertex is a corner of the marker drawn around it
+attribute vec2 iVertex;
+attribute vec2 iPoint;
+uniform float iPointSize;
+
+void main(void) {
+    gl_Position = vec4(iPoint + iPointSize * iVertex, 0., 1.);
+}
@@ -0,0 +1,5 @@
+varying vec2 vTexCoord;
+
+void main(void) {
+    gl_FragColor = texture2D(iTexture, vTexCoord);
+}
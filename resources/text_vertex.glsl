@@ -0,0 +1,9 @@
+// Glyph quads from ui/text.c: position in pixels, then atlas coordinates
+attribute vec4 iVertex;
+uniform vec2 iResolution;
+varying vec2 vTexCoord;
+
+void main(void) {
+    vTexCoord = iVertex.zw;
+    gl_Position = vec4(2. * iVertex.xy / iResolution - 1., 0., 1.);
+}
@@ -0,0 +1,46 @@
+#include "time/pacer.h"
+
+// Weight of the newest frame in `fps`
+#define FPS_ALPHA 0.05
+
+void pacer_init(struct pacer * pacer, double fps) {
+    pacer->period = SDL_GetPerformanceFrequency() / fps;
+    pacer->next = SDL_GetPerformanceCounter();
+    pacer->last = pacer->next;
+    pacer->dt = 1. / fps;
+    pacer->fps = fps;
+    pacer->n_late = 0;
+}
+
+static void pacer_start_frame(struct pacer * pacer, Uint64 now) {
+    if(now - pacer->next > pacer->period) {
+        // Too far behind to catch up; start counting from here
+        pacer->next = now;
+        pacer->n_late++;
+    }
+    pacer->next += pacer->period;
+
+    pacer->dt = (double) (now - pacer->last) / SDL_GetPerformanceFrequency();
+    pacer->last = now;
+    if(pacer->dt > 0) pacer->fps += FPS_ALPHA * (1. / pacer->dt - pacer->fps);
+}
+
+void pacer_wait(struct pacer * pacer) {
+    Uint64 freq = SDL_GetPerformanceFrequency();
+    Uint64 now = SDL_GetPerformanceCounter();
+
+    if(now < pacer->next) {
+        // SDL_Delay can oversleep by a millisecond or so; spin for the rest
+        Uint32 ms = (pacer->next - now) * 1000 / freq;
+        if(ms > 1) SDL_Delay(ms - 1);
+        while((now = SDL_GetPerformanceCounter()) < pacer->next);
+    }
+    pacer_start_frame(pacer, now);
+}
+
+bool pacer_ready(struct pacer * pacer) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    if(now < pacer->next) return false;
+    pacer_start_frame(pacer, now);
+    return true;
+}
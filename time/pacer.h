@@ -0,0 +1,23 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+
+// Fixed-rate frame pacing, which also measures the real frame intervals
+struct pacer {
+    Uint64 period;  // Performance counter ticks per frame
+    Uint64 next;    // When the next frame is due
+    Uint64 last;    // When the last frame started
+
+    double dt;      // Measured seconds since the previous frame
+    double fps;     // Smoothed measured frame rate
+    int n_late;     // Frames that started more than a period late
+};
+
+void pacer_init(struct pacer * pacer, double fps);
+
+// Sleeps until the next frame is due
+void pacer_wait(struct pacer * pacer);
+
+// Returns true (once) if the next frame is due, without sleeping
+bool pacer_ready(struct pacer * pacer);
@@ -2,70 +2,387 @@
 
 #include "util/err.h"
 #include "util/config.h"
+#include "util/gl.h"
+#include "util/glsl.h"
+#include "util/math.h"
+// The AVX2 gather is built on x86 whatever the compiler flags, and used if the CPU has it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RENDER_GATHER_AVX2
+#include <immintrin.h>
+#endif
 
 #define BYTES_PER_PIXEL 4 // RGBA
+#define SAMPLE_WIDTH 1024 // Width of the output sampling target; it grows in height
+#define STAT_FRAMES 300 // Number of frames to average readback statistics over
+#define FENCE_TIMEOUT_NS 1000000000 // Give up on a readback after 1 second
+#define RENDER_FRAME_INDEX 0x3
+#define RENDER_FRAME_FRESH 0x4 // Set on `middle` when it is newer than `front`
 
 void render_init(struct render * render, GLint texture) {
     GLenum e;
 
     memset(render, 0, sizeof *render);
-    render->pixels = calloc(config.pattern.master_width * config.pattern.master_height * BYTES_PER_PIXEL, sizeof(uint8_t));
-    if(render->pixels == NULL) MEMFAIL();
+    render->tex = texture;
+    render->readback_width = config.pattern.master_width;
+    render->readback_height = config.pattern.master_height;
+    render->front = 0;
+    SDL_AtomicSet(&render->middle, 1);
+    render->back = 2;
 
-    glGenFramebuffersEXT(1, &render->fb);
+    glGenFramebuffers(1, &render->fb);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, render->fb);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, texture, 0);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, render->fb);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
-    render->mutex = SDL_CreateMutex();
-    if(render->mutex == NULL) FAIL("Could not create mutex: %s\n", SDL_GetError());
+    render->layout_mutex = SDL_CreateMutex();
+    if(render->layout_mutex == NULL) FAIL("Could not create mutex: %s\n", SDL_GetError());
+    render->frame_sem = SDL_CreateSemaphore(0);
+    if(render->frame_sem == NULL) FAIL("Could not create semaphore: %s\n", SDL_GetError());
+
+    if(config.render.sample_on_gpu) {
+        render->sample_shader = load_shader("resources/sample.glsl");
+        if(render->sample_shader == 0) FAIL("Unable to load sample shader:\n%s", load_shader_error);
+
+        glGenFramebuffers(1, &render->sample_fb);
+        glGenTextures(1, &render->sample_tex);
+        glGenTextures(1, &render->coord_tex);
+        if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+
+        GLuint texs[2] = {render->sample_tex, render->coord_tex};
+        for(int i = 0; i < 2; i++) {
+            glBindTexture(GL_TEXTURE_2D, texs[i]);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+
+        // Nothing to sample until the output thread sets up its devices
+        render->readback_width = 0;
+        render->readback_height = 0;
+    }
+
+    // A readback started on frame N is mapped on frame N + readback_latency,
+    // so we need one more buffer than there are frames in flight
+    if(config.render.readback_latency > 0) {
+        size_t size = render->readback_width * render->readback_height * BYTES_PER_PIXEL;
+
+        render->n_pbos = config.render.readback_latency + 1;
+        render->pbos = calloc(render->n_pbos, sizeof *render->pbos);
+        if(render->pbos == NULL) MEMFAIL();
+        render->fences = calloc(render->n_pbos, sizeof *render->fences);
+        if(render->fences == NULL) MEMFAIL();
+
+        glGenBuffers(render->n_pbos, render->pbos);
+        for(int i = 0; i < render->n_pbos; i++) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, render->pbos[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+    }
 }
 
 void render_term(struct render * render) {
-    free(render->pixels);
-    glDeleteFramebuffersEXT(1, &render->fb);
-    SDL_DestroyMutex(render->mutex);
+    for(int i = 0; i < render->n_pbos; i++) {
+        if(render->fences[i] != NULL) glDeleteSync(render->fences[i]);
+    }
+    if(render->n_pbos > 0) glDeleteBuffers(render->n_pbos, render->pbos);
+    free(render->pbos);
+    free(render->fences);
+    if(render->sample_shader != 0) {
+        gl_delete_program(render->sample_shader);
+        glDeleteTextures(1, &render->sample_tex);
+        glDeleteTextures(1, &render->coord_tex);
+        glDeleteFramebuffers(1, &render->sample_fb);
+    }
+    free(render->layout_coords);
+    for(int i = 0; i < 3; i++) free(render->frames[i].pixels);
+    glDeleteFramebuffers(1, &render->fb);
+    SDL_DestroyMutex(render->layout_mutex);
+    SDL_DestroySemaphore(render->frame_sem);
     memset(render, 0, sizeof *render);
 }
 
-void render_readback(struct render * render) {
+unsigned int render_set_samples(struct render * render, float * coords, size_t length) {
+    SDL_LockMutex(render->layout_mutex);
+    free(render->layout_coords);
+    render->layout_coords = coords;
+    render->layout_length = length;
+    unsigned int layout = ++render->layout_count;
+    render->layout_changed = true;
+    SDL_UnlockMutex(render->layout_mutex);
+    return layout;
+}
+
+unsigned int render_get_samples(struct render * render, unsigned int layout, float ** coords, size_t * length) {
+    *coords = NULL;
+    *length = 0;
+
+    SDL_LockMutex(render->layout_mutex);
+    unsigned int current = render->layout_count;
+    if(current != layout) {
+        *length = render->layout_length;
+        *coords = malloc(2 * *length * sizeof **coords + 1);
+        if(*coords == NULL) MEMFAIL();
+        if(*length > 0) memcpy(*coords, render->layout_coords, 2 * *length * sizeof **coords);
+    }
+    SDL_UnlockMutex(render->layout_mutex);
+    return current;
+}
+
+// Upload a new set of output pixel coordinates and resize everything downstream of it
+void render_update_layout(struct render * render) {
     GLenum e;
 
-    if(SDL_TryLockMutex(render->mutex) == 0) {
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, render->fb);
-        glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
-        glReadPixels(0, 0, config.pattern.master_width, config.pattern.master_height, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)render->pixels);
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    if(render->sample_shader == 0 || !render->layout_changed) return;
+    if(SDL_TryLockMutex(render->layout_mutex) != 0) return;
+
+    size_t n = render->layout_length;
+    int width = MIN(n, SAMPLE_WIDTH);
+    int height = (n + SAMPLE_WIDTH - 1) / SAMPLE_WIDTH;
+
+    // Pad the coordinates out to a whole number of rows
+    float * coords = calloc(2 * width * height + 1, sizeof *coords);
+    if(coords == NULL) MEMFAIL();
+    memcpy(coords, render->layout_coords, 2 * n * sizeof *coords);
+    render->layout = render->layout_count;
+    render->layout_changed = false;
+    SDL_UnlockMutex(render->layout_mutex);
+
+    if(n > 0) {
+        glBindTexture(GL_TEXTURE_2D, render->coord_tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, width, height, 0, GL_RG, GL_FLOAT, coords);
+        glBindTexture(GL_TEXTURE_2D, render->sample_tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, render->sample_fb);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, render->sample_tex, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
         if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
-        SDL_UnlockMutex(render->mutex);
     }
+    free(coords);
+
+    render->n_samples = n;
+    render->readback_width = width;
+    render->readback_height = height;
+    size_t size = width * height * BYTES_PER_PIXEL;
+
+    // Anything still in flight was sampled with the old layout
+    for(int i = 0; i < render->n_pbos; i++) {
+        if(render->fences[i] != NULL) glDeleteSync(render->fences[i]);
+        render->fences[i] = NULL;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, render->pbos[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+
+    DEBUG("Sampling %zu output pixels from a %dx%d target", n, width, height);
+}
+
+// Sample the canvas at every output pixel into `sample_tex`
+static void render_sample_pass(struct render * render) {
+    GLenum e;
+
+    glViewport(0, 0, render->readback_width, render->readback_height);
+    glBindFramebuffer(GL_FRAMEBUFFER, render->sample_fb);
+    glUseProgram(render->sample_shader);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, render->tex);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, render->coord_tex);
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+
+    GLint loc;
+    loc = gl_uniform(render->sample_shader, "iResolution");
+    glUniform2f(loc, render->readback_width, render->readback_height);
+    loc = gl_uniform(render->sample_shader, "iCanvasResolution");
+    glUniform2f(loc, config.pattern.master_width, config.pattern.master_height);
+    loc = gl_uniform(render->sample_shader, "iFrame");
+    glUniform1i(loc, 0);
+    loc = gl_uniform(render->sample_shader, "iCoords");
+    glUniform1i(loc, 1);
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+
+    gl_fill();
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+}
+
+// Get the back buffer ready to hold `size` bytes
+static struct render_frame * render_back_frame(struct render * render, size_t size) {
+    struct render_frame * frame = &render->frames[render->back];
+    if(frame->size < size) {
+        free(frame->pixels);
+        frame->pixels = calloc(size, sizeof(uint8_t));
+        if(frame->pixels == NULL) MEMFAIL();
+        frame->size = size;
+    }
+    return frame;
+}
+
+// Hand the back buffer over to the output thread
+static void render_publish(struct render * render) {
+    struct render_frame * frame = &render->frames[render->back];
+    frame->layout = render->layout;
+    frame->seq = ++render->seq;
+    frame->published = SDL_GetPerformanceCounter();
+    render->back = SDL_AtomicSet(&render->middle, render->back | RENDER_FRAME_FRESH) & RENDER_FRAME_INDEX;
+    render_wake(render);
+}
+
+const struct render_frame * render_acquire(struct render * render) {
+    if(SDL_AtomicGet(&render->middle) & RENDER_FRAME_FRESH) {
+        render->front = SDL_AtomicSet(&render->middle, render->front) & RENDER_FRAME_INDEX;
+    }
+    return &render->frames[render->front];
 }
 
-void render_freeze(struct render * render) {
-    SDL_LockMutex(render->mutex);
+bool render_wait(struct render * render, int timeout_ms) {
+    if(SDL_AtomicGet(&render->middle) & RENDER_FRAME_FRESH) return true;
+    if(timeout_ms <= 0) return SDL_SemWait(render->frame_sem) == 0;
+    return SDL_SemWaitTimeout(render->frame_sem, timeout_ms) == 0;
+}
+
+void render_wake(struct render * render) {
+    // Wakeups don't need counting: the waiter always takes the newest frame
+    if(SDL_SemValue(render->frame_sem) == 0) SDL_SemPost(render->frame_sem);
+}
+
+static void render_readback_sync(struct render * render) {
+    size_t size = render->readback_width * render->readback_height * BYTES_PER_PIXEL;
+    struct render_frame * frame = render_back_frame(render, size);
+    glReadPixels(0, 0, render->readback_width, render->readback_height, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*)frame->pixels);
+    render_publish(render);
+}
+
+static void render_readback_async(struct render * render) {
+    size_t size = render->readback_width * render->readback_height * BYTES_PER_PIXEL;
+
+    // Start reading this frame into the next buffer in the ring
+    int head = render->pbo_frame % render->n_pbos;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, render->pbos[head]);
+    glReadPixels(0, 0, render->readback_width, render->readback_height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    render->fences[head] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    render->pbo_frame++;
+
+    // Pick up the readback that was started `readback_latency` frames ago
+    int tail = render->pbo_frame % render->n_pbos;
+    GLsync fence = render->fences[tail];
+    if(fence == NULL) goto done; // Still filling the ring
+    render->fences[tail] = NULL;
+
+    GLenum rc = glClientWaitSync(fence, 0, 0);
+    if(rc == GL_TIMEOUT_EXPIRED) {
+        rc = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT_NS);
+    } else {
+        render->stat_ready++;
+    }
+    glDeleteSync(fence);
+    if(rc == GL_WAIT_FAILED || rc == GL_TIMEOUT_EXPIRED) {
+        LOGLIMIT(ERROR, "Dropped frame waiting for readback");
+        goto done;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, render->pbos[tail]);
+    void * pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if(pixels != NULL) {
+        struct render_frame * frame = render_back_frame(render, size);
+        memcpy(frame->pixels, pixels, size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        render_publish(render);
+    }
+
+done:
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 }
 
-void render_thaw(struct render * render) {
-    SDL_UnlockMutex(render->mutex);
+void render_readback(struct render * render, GLuint sparse_tex) {
+    GLenum e;
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    if(render->sample_shader != 0) {
+        if(render->n_samples == 0) return;
+        glBindFramebuffer(GL_FRAMEBUFFER, render->sample_fb);
+        if(sparse_tex != 0) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sparse_tex, 0);
+        } else {
+            render_sample_pass(render);
+            glBindFramebuffer(GL_FRAMEBUFFER, render->sample_fb);
+        }
+    } else {
+        glBindFramebuffer(GL_FRAMEBUFFER, render->fb);
+    }
+
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    if(render->n_pbos > 0) render_readback_async(render);
+    else render_readback_sync(render);
+    if(sparse_tex != 0) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, render->sample_tex, 0);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+
+    // Time spent here is time the UI thread was stalled waiting on the GPU.
+    // Compare against `readback_latency = 0` to see how much the ring saves.
+    render->stat_stall += SDL_GetPerformanceCounter() - start;
+    if(++render->stat_frames == STAT_FRAMES) {
+        double stall_ms = 1000. * render->stat_stall / SDL_GetPerformanceFrequency() / STAT_FRAMES;
+        if(render->n_pbos > 0) {
+            DEBUG("Readback stall: %0.3f ms/frame; latency=%d; %d%% ready without waiting",
+                  stall_ms, render->n_pbos - 1, 100 * render->stat_ready / STAT_FRAMES);
+        } else {
+            DEBUG("Readback stall: %0.3f ms/frame; synchronous", stall_ms);
+        }
+        render->stat_stall = 0;
+        render->stat_frames = 0;
+        render->stat_ready = 0;
+    }
 }
 
-SDL_Color render_sample(struct render * render, float x, float y) {
+uint32_t render_sample_offset(float x, float y) {
     int col = 0.5 * (x + 1) * config.pattern.master_width;
     int row = 0.5 * (-y + 1) * config.pattern.master_height;
     if(col < 0) col = 0;
     if(row < 0) row = 0;
     if(col >= config.pattern.master_width) col = config.pattern.master_width - 1;
     if(row >= config.pattern.master_height) row = config.pattern.master_height - 1;
-    long index = BYTES_PER_PIXEL * (row * config.pattern.master_height + col);
-
-    // Use NEAREST interpolation for now
-    SDL_Color c;
-    c.r = render->pixels[index];
-    c.g = render->pixels[index + 1];
-    c.b = render->pixels[index + 2];
-    c.a = render->pixels[index + 3];
-    return c;
+    return BYTES_PER_PIXEL * (row * config.pattern.master_width + col);
+}
+
+#ifdef RENDER_GATHER_AVX2
+// Returns how many pixels were gathered, a multiple of 8
+__attribute__((target("avx2")))
+static size_t render_gather_avx2(const struct render_frame * frame, const uint32_t * offsets, size_t length, SDL_Color * colors) {
+    size_t i = 0;
+    for(; i + 8 <= length; i += 8) {
+        __m256i index = _mm256_loadu_si256((const __m256i *) &offsets[i]);
+        __m256i pixels = _mm256_i32gather_epi32((const int *) frame->pixels, index, 1);
+        _mm256_storeu_si256((__m256i *) &colors[i], pixels);
+    }
+    return i;
+}
+#endif
+
+// Use NEAREST interpolation for now; the frame's RGBA bytes are laid out like SDL_Color
+void render_gather(const struct render_frame * frame, const uint32_t * offsets, size_t length, SDL_Color * colors) {
+    size_t i = 0;
+#ifdef RENDER_GATHER_AVX2
+    static int avx2 = -1;
+    if(avx2 < 0) avx2 = __builtin_cpu_supports("avx2");
+    if(avx2) i = render_gather_avx2(frame, offsets, length, colors);
+#endif
+    for(; i < length; i++) {
+        memcpy(&colors[i], &frame->pixels[offsets[i]], sizeof *colors);
+    }
 }
@@ -4,18 +4,94 @@
 #include <SDL2/SDL_opengl.h>
 #include "util/opengl.h"
 #include <stdint.h>
+#include <stdbool.h>
 #include <SDL2/SDL.h>
 
+// A frame of pixels read back from the GPU
+struct render_frame {
+    uint8_t * pixels;
+    size_t size;
+    unsigned int layout; // Layout the pixels were sampled with
+    unsigned long seq; // Sequence number; 0 if nothing has been published yet
+    Uint64 published; // SDL_GetPerformanceCounter() when it was read back
+};
+
 struct render {
     GLuint fb;
-    uint8_t * pixels;
-    SDL_mutex * mutex;
+    GLuint tex;
+
+    // Triple buffer between the GL thread and the output thread.
+    // The GL thread fills `back` and swaps it with `middle`, the output
+    // thread swaps `front` with `middle` whenever there is a newer frame.
+    struct render_frame frames[3];
+    int back; // Owned by the GL thread
+    int front; // Owned by the output thread
+    SDL_atomic_t middle; // Index of the frame in between, plus RENDER_FRAME_FRESH
+    unsigned long seq;
+    SDL_sem * frame_sem; // Posted when a frame is published
+
+    // Size of the framebuffer read back into `pixels`:
+    // the whole canvas, or one texel per output pixel when sampling on the GPU
+    int readback_width;
+    int readback_height;
+
+    // Output sampling pass (`config.render.sample_on_gpu`)
+    GLuint sample_shader;
+    GLuint sample_fb;
+    GLuint sample_tex;
+    GLuint coord_tex;
+    size_t n_samples;
+    unsigned int layout; // Layout currently uploaded to `coord_tex`
+
+    // Output pixel coordinates handed over by the output thread
+    SDL_mutex * layout_mutex;
+    float * layout_coords;
+    size_t layout_length;
+    unsigned int layout_count;
+    volatile bool layout_changed;
+
+    // Ring of pixel buffers for asynchronous readback
+    // (empty when `config.render.readback_latency` is 0)
+    int n_pbos;
+    GLuint * pbos;
+    GLsync * fences;
+    unsigned int pbo_frame;
+
+    // Statistics
+    Uint64 stat_stall;
+    int stat_frames;
+    int stat_ready;
 };
 
 void render_init(struct render * render, GLint texture);
-void render_readback(struct render * render);
+// Pick up output pixel coordinates set since the last frame; call before
+// anything else this frame uses `coord_tex` or the readback size
+void render_update_layout(struct render * render);
+// Read back the output. `sparse_tex`, if not 0, already holds the output
+// pixels (laid out like `coord_tex`), so the sampling pass is skipped
+void render_readback(struct render * render, GLuint sparse_tex);
 void render_term(struct render * render);
 
-void render_freeze(struct render * render);
-void render_thaw(struct render * render);
-SDL_Color render_sample(struct render * render, float x, float y);
+// Set the output pixel coordinates to sample; called from the output thread.
+// `coords` holds interleaved (x, y) pairs and is owned by the render afterwards.
+// Returns the layout number that `render_frame.layout` will match once it is in use.
+unsigned int render_set_samples(struct render * render, float * coords, size_t length);
+
+// Copy out the output pixel coordinates if they changed since `layout`; called from the GL thread.
+// `*coords` is NULL when nothing changed, and is owned by the caller otherwise.
+// Returns the current layout number.
+unsigned int render_get_samples(struct render * render, unsigned int layout, float ** coords, size_t * length);
+
+// Grab the newest complete frame; called from the output thread.
+// The frame stays valid until the next call.
+const struct render_frame * render_acquire(struct render * render);
+// Block until a frame is published or `timeout_ms` passes (if it's positive); called from the output thread.
+// Returns true if there may be a new frame.
+bool render_wait(struct render * render, int timeout_ms);
+// Wake up render_wait() without a new frame
+void render_wake(struct render * render);
+
+// Byte offset of the canvas pixel nearest to (x, y), in a frame read back without `sample_shader`
+uint32_t render_sample_offset(float x, float y);
+// Fill `colors` from the pixels at `offsets` (from render_sample_offset()), 8 at a time on CPUs with AVX2
+void render_gather(const struct render_frame * frame, const uint32_t * offsets, size_t length, SDL_Color * colors);
@@ -0,0 +1,205 @@
+#include "ui/text.h"
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+#include "util/config.h"
+#include "util/err.h"
+#include "util/gl.h"
+#include "util/glsl.h"
+#include "util/opengl.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FIRST_GLYPH 32 // ' '
+#define LAST_GLYPH 126 // '~'
+#define N_GLYPHS (LAST_GLYPH - FIRST_GLYPH + 1)
+#define MISSING_GLYPH '?'
+#define ATLAS_WIDTH 512
+#define GLYPH_PADDING 1 // Keeps neighbouring glyphs from bleeding into each other
+
+struct glyph {
+    int x; // Position in the atlas
+    int y;
+    int w; // Size of the rendered glyph
+    int h;
+    int advance;
+};
+
+struct text_vertex {
+    GLfloat x;
+    GLfloat y;
+    GLfloat u;
+    GLfloat v;
+};
+
+static struct glyph glyphs[N_GLYPHS];
+static int line_height;
+static int atlas_height;
+static GLuint atlas_texture;
+static GLuint text_shader;
+static GLuint vbo;
+
+// Quads queued since the last text_flush(), 6 vertices per glyph
+static struct text_vertex * vertices = NULL;
+static size_t n_vertices = 0;
+static size_t n_allocated = 0;
+
+static const struct glyph * lookup(char c) {
+    if(c < FIRST_GLYPH || c > LAST_GLYPH) c = MISSING_GLYPH;
+    return &glyphs[c - FIRST_GLYPH];
+}
+
+void text_init() {
+    GLenum e;
+
+    if(TTF_Init() < 0) FAIL("Could not initialize font library: %s\n", TTF_GetError());
+    TTF_Font * font = TTF_OpenFont(config.ui.font, config.ui.fontsize);
+    if(font == NULL) FAIL("Could not open font %s: %s\n", config.ui.font, TTF_GetError());
+    line_height = TTF_FontHeight(font);
+
+    // Render every glyph, then pack them into rows
+    const SDL_Color color = {255, 255, 255, 255};
+    SDL_Surface * surfaces[N_GLYPHS];
+    int x = 0;
+    int y = 0;
+    for(int i = 0; i < N_GLYPHS; i++) {
+        char str[2] = {FIRST_GLYPH + i, '\0'};
+        SDL_Surface * surf = TTF_RenderText_Blended(font, str, color);
+        if(surf == NULL) FAIL("Could not render glyph '%s': %s\n", str, TTF_GetError());
+        surfaces[i] = SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_RGBA32, 0);
+        SDL_FreeSurface(surf);
+        if(surfaces[i] == NULL) FAIL("Could not convert glyph '%s': %s\n", str, SDL_GetError());
+
+        int minx, maxx, miny, maxy, advance;
+        if(TTF_GlyphMetrics(font, FIRST_GLYPH + i, &minx, &maxx, &miny, &maxy, &advance) < 0)
+            advance = surfaces[i]->w;
+
+        if(x + surfaces[i]->w > ATLAS_WIDTH) {
+            x = 0;
+            y += line_height + GLYPH_PADDING;
+        }
+        glyphs[i] = (struct glyph) {x, y, surfaces[i]->w, surfaces[i]->h, advance};
+        x += surfaces[i]->w + GLYPH_PADDING;
+    }
+    atlas_height = y + line_height;
+    TTF_CloseFont(font);
+    TTF_Quit();
+
+    // Upload the atlas, starting from transparent so the padding stays empty
+    void * blank = calloc((size_t) ATLAS_WIDTH * atlas_height, 4);
+    if(blank == NULL) MEMFAIL();
+    glGenTextures(1, &atlas_texture);
+    glBindTexture(GL_TEXTURE_2D, atlas_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ATLAS_WIDTH, atlas_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, blank);
+    free(blank);
+
+    for(int i = 0; i < N_GLYPHS; i++) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, surfaces[i]->pitch / 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, glyphs[i].x, glyphs[i].y, glyphs[i].w, glyphs[i].h, GL_RGBA, GL_UNSIGNED_BYTE, surfaces[i]->pixels);
+        SDL_FreeSurface(surfaces[i]);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenBuffers(1, &vbo);
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+
+    text_shader = load_program("resources/text_vertex.glsl", "resources/text.glsl");
+    if(text_shader == 0) FAIL("Could not load text shader!\n%s", load_shader_error);
+
+    INFO("Built %dx%d glyph atlas from %s", ATLAS_WIDTH, atlas_height, config.ui.font);
+}
+
+void text_term() {
+    gl_delete_program(text_shader);
+    glDeleteBuffers(1, &vbo);
+    glDeleteTextures(1, &atlas_texture);
+    free(vertices);
+    vertices = NULL;
+    n_vertices = 0;
+    n_allocated = 0;
+}
+
+void text_size(const char * text, int * w, int * h) {
+    int width = 0;
+    for(const char * c = text; *c != '\0'; c++) {
+        width += lookup(*c)->advance;
+    }
+    if(w != NULL) *w = width;
+    if(h != NULL) *h = line_height;
+}
+
+void text_draw(const char * text, float x, float y) {
+    size_t length = strlen(text);
+    if(n_vertices + 6 * length > n_allocated) {
+        while(n_vertices + 6 * length > n_allocated) {
+            n_allocated = n_allocated ? 2 * n_allocated : 1024;
+        }
+        vertices = realloc(vertices, n_allocated * sizeof *vertices);
+        if(vertices == NULL) MEMFAIL();
+    }
+
+    for(const char * c = text; *c != '\0'; c++) {
+        const struct glyph * g = lookup(*c);
+        GLfloat x0 = x;
+        GLfloat x1 = x + g->w;
+        GLfloat y0 = y;
+        GLfloat y1 = y - g->h;
+        GLfloat u0 = (GLfloat) g->x / ATLAS_WIDTH;
+        GLfloat u1 = (GLfloat) (g->x + g->w) / ATLAS_WIDTH;
+        GLfloat v0 = (GLfloat) g->y / atlas_height;
+        GLfloat v1 = (GLfloat) (g->y + g->h) / atlas_height;
+
+        struct text_vertex * v = &vertices[n_vertices];
+        v[0] = (struct text_vertex) {x0, y0, u0, v0};
+        v[1] = (struct text_vertex) {x0, y1, u0, v1};
+        v[2] = (struct text_vertex) {x1, y1, u1, v1};
+        v[3] = (struct text_vertex) {x0, y0, u0, v0};
+        v[4] = (struct text_vertex) {x1, y1, u1, v1};
+        v[5] = (struct text_vertex) {x1, y0, u1, v0};
+        n_vertices += 6;
+        x += g->advance;
+    }
+}
+
+void text_flush() {
+    GLenum e;
+
+    if(n_vertices == 0) return;
+
+    // Quads are in pixels from the corner of the viewport
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    glUseProgram(text_shader);
+    glUniform1i(gl_uniform(text_shader, "iTexture"), 0);
+    glUniform2f(gl_uniform(text_shader, "iResolution"), viewport[2], viewport[3]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, atlas_texture);
+
+    // Orphan last frame's storage rather than waiting for the GPU to be done with it
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, n_vertices * sizeof *vertices, NULL, GL_STREAM_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, n_vertices * sizeof *vertices, vertices, GL_STREAM_DRAW);
+
+    glEnableVertexAttribArray(SHADER_ATTRIB_VERTEX);
+    glVertexAttribPointer(SHADER_ATTRIB_VERTEX, 4, GL_FLOAT, GL_FALSE, sizeof *vertices, (const GLvoid *) offsetof(struct text_vertex, x));
+
+    // Keep the destination's alpha when the text lands on something transparent
+    glEnable(GL_BLEND);
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glDrawArrays(GL_TRIANGLES, 0, n_vertices);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDisable(GL_BLEND);
+
+    glDisableVertexAttribArray(SHADER_ATTRIB_VERTEX);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    n_vertices = 0;
+
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+}
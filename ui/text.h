@@ -0,0 +1,17 @@
+#pragma once
+
+// Text drawn from a glyph atlas of `config.ui.font`, built once at startup.
+// Glyphs are queued as quads with text_draw() and drawn in one batch by
+// text_flush(), into whatever framebuffer and projection are current.
+
+void text_init();
+void text_term();
+
+// Size of `text` in pixels, as it would be drawn
+void text_size(const char * text, int * w, int * h);
+
+// Queue `text` with its top-left corner at (x, y), with y pointing up
+void text_draw(const char * text, float x, float y);
+
+// Draw everything queued since the last flush
+void text_flush();
@@ -1,18 +1,18 @@
 #include "ui/ui.h"
 
 #include <SDL2/SDL.h>
-#define GL_GLEXT_PROTOTYPES
-#include <SDL2/SDL_opengl.h>
-#include <SDL2/SDL_ttf.h>
 #include "pattern/pattern.h"
+#include "pattern/catalog.h"
 #include "util/config.h"
 #include "util/err.h"
+#include "util/gl.h"
 #include "util/glsl.h"
 #include "util/math.h"
 #include "midi/midi.h"
 #include "output/output.h"
 #include "audio/analyze.h"
 #include "ui/render.h"
+#include "ui/text.h"
 #include "output/slice.h"
 #include "main.h"
 #include <stdio.h>
@@ -21,16 +21,16 @@
 
 static SDL_Window * window;
 static SDL_GLContext context;
-static SDL_Renderer * renderer;
-static bool quit;
-static GLhandleARB main_shader;
-static GLhandleARB pat_shader;
-static GLhandleARB blit_shader;
-static GLhandleARB crossfader_shader;
-static GLhandleARB text_shader;
-static GLhandleARB spectrum_shader;
-static GLhandleARB waveform_shader;
-static GLhandleARB strip_shader;
+static bool quit = false;
+static bool headless;
+static GLuint main_shader;
+static GLuint pat_shader;
+static GLuint blit_shader;
+static GLuint crossfader_shader;
+static GLuint text_shader;
+static GLuint spectrum_shader;
+static GLuint waveform_shader;
+static GLuint strip_shader;
 
 static GLuint pat_fb;
 static GLuint select_fb;
@@ -41,9 +41,6 @@ static GLuint waveform_fb;
 static GLuint strip_fb;
 static GLuint select_tex;
 static GLuint * pattern_textures;
-static SDL_Texture ** pattern_name_textures;
-static int * pattern_name_width;
-static int * pattern_name_height;
 static GLuint crossfader_texture;
 static GLuint pat_entry_texture;
 static GLuint tex_spectrum_data;
@@ -52,6 +49,7 @@ static GLuint tex_waveform_data;
 static GLuint tex_waveform_beats_data;
 static GLuint waveform_texture;
 static GLuint strip_texture;
+static GLuint strip_vbo;
 
 // Window
 static int ww; // Window width
@@ -71,6 +69,23 @@ static int selected = 0;
 
 // Strip indicators
 static enum {STRIPS_NONE, STRIPS_SOLID, STRIPS_COLORED} strip_indicator = STRIPS_NONE;
+static bool strip_instancing;
+static unsigned int strip_layout; // Render layout that strip_vbo was built from
+static GLsizei strip_count; // Number of output pixels in strip_vbo
+static GLint strip_point; // Location of the per-pixel iPoint attribute
+static const GLfloat strip_marker[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+
+// Everything the selection buffer depends on; it is only redrawn when this changes
+struct select_layout {
+    bool loaded[16];
+    float intensity[16];
+    float crossfader;
+    int left_deck;
+    int right_deck;
+    int selected;
+};
+static struct select_layout select_layout;
+static bool select_valid = false;
 
 // False colors
 #define HIT_NOTHING 0
@@ -109,105 +124,90 @@ static const int map_end[19] =   {8,  8,  8,  8,  8,  8,  8,  8,  8,  16, 16, 16
 
 static int snap_states[19];
 
-// Font
-TTF_Font * font = NULL;
-static const SDL_Color font_color = {255, 255, 255, 255};
-
 // Pat entry
 static bool pat_entry;
 static char pat_entry_text[255];
 
-// Timing
-static double l_t;
-
-// Deck selector
-static int left_deck_selector = 0;
-static int right_deck_selector = 1;
-
 // Forward declarations
 static void handle_text(const char * text);
 
 //
 
-static void fill(float w, float h) {
-    glBegin(GL_QUADS);
-    glVertex2f(0, 0);
-    glVertex2f(0, h);
-    glVertex2f(w, h);
-    glVertex2f(w, 0);
-    glEnd();
-}
-
-static SDL_Texture * render_text(char * text, int * w, int * h) {
-    // We need to first render to a surface as that's what TTF_RenderText
-    // returns, then load that surface into a texture
-    SDL_Surface * surf;
-    if(strlen(text) > 0) {
-        surf = TTF_RenderText_Blended(font, text, font_color);
-    } else {
-        surf = TTF_RenderText_Blended(font, " ", font_color);
-    }
-    if(surf == NULL) FAIL("Could not create surface: %s\n", SDL_GetError());
-    if(w != NULL) *w = surf->w;
-    if(h != NULL) *h = surf->h;
-    SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surf);
-    if(texture == NULL) FAIL("Could not create texture: %s\n", SDL_GetError());
-    SDL_FreeSurface(surf);
-    return texture;
-}
-
-static void render_textbox(char * text, int width, int height) {
+static void render_textbox(const char * text, int width, int height) {
     GLint location;
 
-    glUseProgramObjectARB(text_shader);
-    location = glGetUniformLocationARB(text_shader, "iResolution");
-    glUniform2fARB(location, width, height);
+    glUseProgram(text_shader);
+    location = gl_uniform(text_shader, "iResolution");
+    glUniform2f(location, width, height);
 
-    int text_w;
-    int text_h;
+    glViewport(0, 0, width, height);
+    glClear(GL_COLOR_BUFFER_BIT);
+    gl_fill();
 
-    SDL_Texture * tex = render_text(text, &text_w, &text_h);
+    // The text sits inside the box's border, on its bottom line
+    int text_h;
+    text_size(text, NULL, &text_h);
+    text_draw(text, 40, 45 + text_h);
+    text_flush();
+}
 
-    location = glGetUniformLocationARB(text_shader, "iTextResolution");
-    glUniform2fARB(location, text_w, text_h);
-    location = glGetUniformLocationARB(text_shader, "iText");
-    glUniform1iARB(location, 0);
-    glActiveTexture(GL_TEXTURE0);
-    SDL_GL_BindTexture(tex, NULL, NULL);
+// Use a core profile context if one is configured and available, or the legacy one otherwise.
+// Returns true for a core context
+static bool create_context() {
+    if(config.render.gl_core) {
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+#ifdef __APPLE__
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG);
+#endif
+        context = SDL_GL_CreateContext(window);
+        if(context != NULL) return true;
+        WARN("Could not create an OpenGL 3.3 core context, falling back to legacy: %s", SDL_GetError());
+#ifdef __APPLE__
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, 0);
+#endif
+    }
 
-    glLoadIdentity();
-    gluOrtho2D(0, width, 0, height);
-    glViewport(0, 0, width, height);
-    glClear(GL_COLOR_BUFFER_BIT);
-    fill(width, height);
-    SDL_DestroyTexture(tex);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 1);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
+    context = SDL_GL_CreateContext(window);
+    if(context == NULL) FAIL("OpenGL context could not be created: %s\n", SDL_GetError());
+    return false;
 }
 
 void ui_init() {
     // Init SDL
+    if(config.headless.enabled && SDL_getenv("SDL_VIDEODRIVER") == NULL) {
+        // Prefer SDL's EGL-backed offscreen driver, which needs no display at all
+        for(int i = 0; i < SDL_GetNumVideoDrivers(); i++) {
+            if(strcmp(SDL_GetVideoDriver(i), "offscreen") == 0) SDL_setenv("SDL_VIDEODRIVER", "offscreen", 0);
+        }
+    }
     if(SDL_Init(SDL_INIT_VIDEO) < 0) FAIL("SDL could not initialize! SDL Error: %s\n", SDL_GetError());
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 1);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
 
     ww = config.ui.window_width;
     wh = config.ui.window_height;
+    headless = config.headless.enabled;
 
-    window = SDL_CreateWindow("Radiance", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, ww, wh, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
-    if(window == NULL) FAIL("Window could not be created: %s\n", SDL_GetError());
-    context = SDL_GL_CreateContext(window);
-    if(context == NULL) FAIL("OpenGL context could not be created: %s\n", SDL_GetError());
-    if(SDL_GL_SetSwapInterval(1) < 0) fprintf(stderr, "Warning: Unable to set VSync: %s\n", SDL_GetError());
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    if(renderer == NULL) FAIL("Could not create renderer: %s\n", SDL_GetError());
-    if(TTF_Init() < 0) FAIL("Could not initialize 
-                            library: %s\n", TTF_GetError());
+    if(headless) {
+        // The GL context still needs a window, but it's never shown or swapped
+        window = SDL_CreateWindow("Radiance", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1, 1, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+        if(window == NULL) FAIL("Offscreen window could not be created: %s\n", SDL_GetError());
+        INFO("Running headless on the %s video driver", SDL_GetCurrentVideoDriver());
+    } else {
+        window = SDL_CreateWindow("Radiance", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, ww, wh, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
+        if(window == NULL) FAIL("Window could not be created: %s\n", SDL_GetError());
+    }
+    bool core = create_context();
+    if(!headless) {
+        // The engine paces itself; waiting on vsync would tie the LEDs to the monitor
+        if(SDL_GL_SetSwapInterval(0) < 0) fprintf(stderr, "Warning: Unable to disable VSync: %s\n", SDL_GetError());
+    }
 
     // Init OpenGL
     GLenum e;
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glMatrixMode(GL_MODELVIEW);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glClearColor(0, 0, 0, 0);
 
@@ -224,15 +224,21 @@ void ui_init() {
     #endif
         FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
     }
+    gl_init(core);
+
+    if(headless) return;
+
+    pattern_textures = calloc(config.ui.n_patterns, sizeof(GLuint));
+    if(pattern_textures == NULL) MEMFAIL();
 
     // Make framebuffers
-    glGenFramebuffersEXT(1, &select_fb);
-    glGenFramebuffersEXT(1, &pat_fb);
-    glGenFramebuffersEXT(1, &crossfader_fb);
-    glGenFramebuffersEXT(1, &pat_entry_fb);
-    glGenFramebuffersEXT(1, &spectrum_fb);
-    glGenFramebuffersEXT(1, &waveform_fb);
-    glGenFramebuffersEXT(1, &strip_fb);
+    glGenFramebuffers(1, &select_fb);
+    glGenFramebuffers(1, &pat_fb);
+    glGenFramebuffers(1, &crossfader_fb);
+    glGenFramebuffers(1, &pat_entry_fb);
+    glGenFramebuffers(1, &spectrum_fb);
+    glGenFramebuffers(1, &waveform_fb);
+    glGenFramebuffers(1, &strip_fb);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
     // Init select texture
@@ -245,16 +251,10 @@ void ui_init() {
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, ww, wh, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
     glBindTexture(GL_TEXTURE_2D, 0);
 
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, select_fb);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, select_tex, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, select_fb);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, select_tex, 0);
 
     // Init pattern textures
-    pattern_textures = calloc(config.ui.n_patterns, sizeof(GLuint));
-    if(pattern_textures == NULL) MEMFAIL();
-    pattern_name_textures = calloc(config.ui.n_patterns, sizeof(SDL_Texture *));
-    pattern_name_width = calloc(config.ui.n_patterns, sizeof(int));
-    pattern_name_height = calloc(config.ui.n_patterns, sizeof(int));
-    if(pattern_name_textures == NULL || pattern_name_width == NULL || pattern_name_height == NULL) MEMFAIL();
     glGenTextures(config.ui.n_patterns, pattern_textures);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
     for(int i = 0; i < config.ui.n_patterns; i++) {
@@ -274,8 +274,8 @@ void ui_init() {
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, config.ui.crossfader_width, config.ui.crossfader_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, crossfader_fb);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, crossfader_texture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, crossfader_fb);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, crossfader_texture, 0);
 
     // Init pattern entry texture
     glGenTextures(1, &pat_entry_texture);
@@ -285,8 +285,8 @@ void ui_init() {
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, config.ui.pat_entry_width, config.ui.pat_entry_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, pat_entry_fb);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, pat_entry_texture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, pat_entry_fb);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pat_entry_texture, 0);
 
     // Spectrum data texture
     glGenTextures(1, &tex_spectrum_data);
@@ -305,8 +305,8 @@ void ui_init() {
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, config.ui.spectrum_width, config.ui.spectrum_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, spectrum_fb);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, spectrum_texture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, spectrum_fb);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, spectrum_texture, 0);
 
     // Waveform data texture
     glGenTextures(1, &tex_waveform_data);
@@ -333,8 +333,8 @@ void ui_init() {
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, config.ui.waveform_width, config.ui.waveform_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, waveform_fb);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, waveform_texture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, waveform_fb);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, waveform_texture, 0);
 
     // Strip indicators
     glGenTextures(1, &strip_texture);
@@ -344,12 +344,12 @@ void ui_init() {
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, config.pattern.master_width, config.pattern.master_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, strip_fb);
-    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, strip_texture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, strip_fb);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, strip_texture, 0);
 
     // Done allocating textures & FBOs, unbind and check for errors
     glBindTexture(GL_TEXTURE_2D, 0);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
     if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
     if((blit_shader = load_shader("resources/blit.glsl")) == 0) FAIL("Could not load blit shader!\n%s", load_shader_error);
@@ -359,45 +359,49 @@ void ui_init() {
     if((text_shader = load_shader("resources/ui_text.glsl")) == 0) FAIL("Could not load UI text shader!\n%s", load_shader_error);
     if((spectrum_shader = load_shader("resources/ui_spectrum.glsl")) == 0) FAIL("Could not load UI spectrum shader!\n%s", load_shader_error);
     if((waveform_shader = load_shader("resources/ui_waveform.glsl")) == 0) FAIL("Could not load UI waveform shader!\n%s", load_shader_error);
-    if((strip_shader = load_shader("resources/strip.glsl")) == 0) FAIL("Could not load strip indicator shader!\n%s", load_shader_error);
+    if((strip_shader = load_program("resources/strip_vertex.glsl", "resources/strip.glsl")) == 0) FAIL("Could not load strip indicator shader!\n%s", load_shader_error);
+    strip_point = glGetAttribLocation(strip_shader, "iPoint");
+
+    // Strip indicators draw one marker per output pixel, from a buffer that only changes with the output layout
+    strip_instancing = gl_core || (SDL_GL_ExtensionSupported("GL_ARB_instanced_arrays")
+                                && SDL_GL_ExtensionSupported("GL_ARB_draw_instanced"));
+    if(!strip_instancing) WARN("Instanced drawing is not supported; strip indicators are disabled");
+    glGenBuffers(1, &strip_vbo);
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
 
     // Stop text input
     SDL_StopTextInput();
 
-    // Open the font
-    font = TTF_OpenFont(config.ui.font, config.ui.fontsize);
-    if(font == NULL) FAIL("Could not open font %s: %s\n", config.ui.font, SDL_GetError());
+    // Build the glyph atlas
+    text_init();
 
     // Init statics
     pat_entry = false;
-
-    SDL_Surface * surf;
-    surf = TTF_RenderText_Blended(font, "wtf, why is this necessary", font_color);
-    if(surf == NULL) FAIL("Could not create surface: %s\n", SDL_GetError());
-    SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surf);
-    if(texture == NULL) FAIL("Could not create texture: %s\n", SDL_GetError());
-    SDL_FreeSurface(surf);
-    SDL_DestroyTexture(texture);
 }
 
 void ui_term() {
-    TTF_CloseFont(font);
-    for(int i=0; i<config.ui.n_patterns; i++) {
-        if(pattern_name_textures[i] != NULL) SDL_DestroyTexture(pattern_name_textures[i]);
+    if(headless) {
+        gl_term();
+        SDL_GL_DeleteContext(context);
+        SDL_DestroyWindow(window);
+        window = NULL;
+        SDL_Quit();
+        return;
     }
+
+    text_term();
     free(pattern_textures);
-    free(pattern_name_textures);
-    free(pattern_name_width);
-    free(pattern_name_height);
     // TODO glDeleteTextures...
-    glDeleteObjectARB(blit_shader);
-    glDeleteObjectARB(main_shader);
-    glDeleteObjectARB(pat_shader);
-    glDeleteObjectARB(crossfader_shader);
-    glDeleteObjectARB(text_shader);
-    glDeleteObjectARB(spectrum_shader);
-    glDeleteObjectARB(waveform_shader);
-    SDL_DestroyRenderer(renderer);
+    gl_delete_program(blit_shader);
+    gl_delete_program(main_shader);
+    gl_delete_program(pat_shader);
+    gl_delete_program(crossfader_shader);
+    gl_delete_program(text_shader);
+    gl_delete_program(spectrum_shader);
+    gl_delete_program(waveform_shader);
+    gl_delete_program(strip_shader);
+    glDeleteBuffers(1, &strip_vbo);
+    gl_term();
     SDL_DestroyWindow(window);
     window = NULL;
     SDL_Quit();
@@ -445,11 +449,6 @@ static void increment_slider(int s, float v) {
 
 static void redraw_pattern_ui(int s) {
     snap_states[s] = 0;
-    const struct pattern * p = deck[map_deck[s]].pattern[map_pattern[s]];
-    if (p == NULL) return;
-    
-    if(pattern_name_textures[s] != NULL) SDL_DestroyTexture(pattern_name_textures[s]);
-    pattern_name_textures[s] = render_text(p->name, &pattern_name_width[s], &pattern_name_height[s]);
 }
 
 static void handle_key(SDL_KeyboardEvent * e) {
@@ -468,14 +467,13 @@ static void handle_key(SDL_KeyboardEvent * e) {
             case SDLK_RETURN:
                 for(int i=0; i<config.ui.n_patterns; i++) {
                     if(map_selection[i] == selected) {
-                        if (deck_load_set(&deck[map_deck[i]], pat_entry_text) == 0) {
-                            for (int j = 0; j < config.ui.n_patterns; j++) {
-                                if (map_deck[j] == map_deck[selected])
-                                    redraw_pattern_ui(j);
-                            }
-                        } else if(deck_load_pattern(&deck[map_deck[i]], map_pattern[i], pat_entry_text, -1) == 0) {
-                            redraw_pattern_ui(i);
-                        }
+                        // The names are redrawn once the new patterns are swapped in
+                        if (pat_entry_text[0] == '\0') // Reload the current pattern
+                            deck_load_pattern(&deck[map_deck[i]], map_pattern[i], "", -1, 0);
+                        else if (pat_entry_text[0] != ':' && catalog_find(pat_entry_text) != NULL)
+                            deck_load_pattern(&deck[map_deck[i]], map_pattern[i], pat_entry_text, -1, 0);
+                        else if (deck_load_set(&deck[map_deck[i]], pat_entry_text) != 0)
+                            ERROR("No pattern or set named '%s'", pat_entry_text);
                         break;
                     }
                 }
@@ -575,9 +573,9 @@ static void handle_key(SDL_KeyboardEvent * e) {
                         pat_entry = true;
                         pat_entry_text[0] = '\0';
                         SDL_StartTextInput();
-                        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, pat_entry_fb);
+                        glBindFramebuffer(GL_FRAMEBUFFER, pat_entry_fb);
                         render_textbox(pat_entry_text, config.ui.pat_entry_width, config.ui.pat_entry_height);
-                        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+                        glBindFramebuffer(GL_FRAMEBUFFER, 0);
                     }
                 }
                 break;
@@ -585,29 +583,29 @@ static void handle_key(SDL_KeyboardEvent * e) {
                 for(int i=0; i<config.ui.n_patterns; i++) {
                     if(map_selection[i] == selected) {
                         if(i < 4) {
-                            left_deck_selector = 0;
+                            crossfader.left_deck = 0;
                         } else if(i < 8) {
-                            right_deck_selector = 1;
+                            crossfader.right_deck = 1;
                         } else if(i < 12) {
-                            left_deck_selector = 2;
+                            crossfader.left_deck = 2;
                         } else if(i < 16) {
-                            right_deck_selector = 3;
+                            crossfader.right_deck = 3;
                         }
                     }
                 }
                 break;
             case SDLK_LEFTBRACKET:
-                if(left_deck_selector == 0) {
-                    left_deck_selector = 2;
+                if(crossfader.left_deck == 0) {
+                    crossfader.left_deck = 2;
                 } else {
-                    left_deck_selector = 0;
+                    crossfader.left_deck = 0;
                 }
                 break;
             case SDLK_RIGHTBRACKET:
-                if(right_deck_selector == 1) {
-                    right_deck_selector = 3;
+                if(crossfader.right_deck == 1) {
+                    crossfader.right_deck = 3;
                 } else {
-                    right_deck_selector = 1;
+                    crossfader.right_deck = 1;
                 }
                 break;
             case SDLK_SPACE:
@@ -663,17 +661,32 @@ static void handle_key(SDL_KeyboardEvent * e) {
 
 static void blit(float x, float y, float w, float h) {
     GLint location;
-    location = glGetUniformLocationARB(blit_shader, "iPosition");
-    glUniform2fARB(location, x, y);
-    location = glGetUniformLocationARB(blit_shader, "iResolution");
-    glUniform2fARB(location, w, h);
-
-    glBegin(GL_QUADS);
-    glVertex2f(x, y);
-    glVertex2f(x, y + h);
-    glVertex2f(x + w, y + h);
-    glVertex2f(x + w, y);
-    glEnd();
+    location = gl_uniform(blit_shader, "iPosition");
+    glUniform2f(location, x, y);
+    location = gl_uniform(blit_shader, "iResolution");
+    glUniform2f(location, w, h);
+
+    glViewport(x, y, w, h);
+    gl_fill();
+}
+
+// Rebuild the strip indicator buffer if the output devices have been re-arranged since it was last built
+static void update_strips() {
+    float * coords;
+    size_t length;
+
+    if(!strip_instancing) return;
+    strip_layout = render_get_samples(&render, strip_layout, &coords, &length);
+    if(coords == NULL) return;
+
+    // The marker shape goes first, followed by the position of every output pixel
+    glBindBuffer(GL_ARRAY_BUFFER, strip_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof strip_marker + 2 * length * sizeof *coords, NULL, GL_STATIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof strip_marker, strip_marker);
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof strip_marker, 2 * length * sizeof *coords, coords);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    strip_count = length;
+    free(coords);
 }
 
 static void ui_render(bool select) {
@@ -681,64 +694,44 @@ static void ui_render(bool select) {
     GLenum e;
 
     // Render strip indicators
-    switch(strip_indicator) {
+    switch(select ? STRIPS_NONE : strip_indicator) {
         case STRIPS_SOLID:
         case STRIPS_COLORED:
-            glLoadIdentity();
             glViewport(0, 0, config.pattern.master_width, config.pattern.master_height);
-            glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, strip_fb);
-            glUseProgramObjectARB(strip_shader);
+            glBindFramebuffer(GL_FRAMEBUFFER, strip_fb);
+            glUseProgram(strip_shader);
 
-            location = glGetUniformLocationARB(strip_shader, "iPreview");
-            glUniform1iARB(location, 0);
-            location = glGetUniformLocationARB(strip_shader, "iResolution");
-            glUniform2fARB(location, config.pattern.master_width, config.pattern.master_height);
-            location = glGetUniformLocationARB(strip_shader, "iIndicator");
-            glUniform1iARB(location, strip_indicator);
+            location = gl_uniform(strip_shader, "iPreview");
+            glUniform1i(location, 0);
+            location = gl_uniform(strip_shader, "iResolution");
+            glUniform2f(location, config.pattern.master_width, config.pattern.master_height);
+            location = gl_uniform(strip_shader, "iIndicator");
+            glUniform1i(location, strip_indicator);
 
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, crossfader.tex_output);
 
             glClear(GL_COLOR_BUFFER_BIT);
-            glBegin(GL_QUADS);
-            for(struct output_device * d = output_device_head; d != NULL; d = d->next) {
-#ifdef SOLID_LINE_INDICATOR
-                bool first = true;
-                double x;
-                double y;
-                for(struct output_vertex * v = d->vertex_head; v != NULL; v = v->next) {
-                    if(!first) {
-                        double dx = v->x - x;
-                        double dy = -v->y - y;
-                        double dl = hypot(dx, dy);
-                        dx = config.ui.strip_thickness * dx / dl;
-                        dy = config.ui.strip_thickness * dy / dl;
-                        glVertex2d(x + dy, y - dx);
-                        glVertex2d(v->x + dy, -v->y - dx);
-                        glVertex2d(v->x - dy, -v->y + dx);
-                        glVertex2d(x - dy, y + dx);
-                    } else {
-                        first = false;
-                    }
-                    x = v->x;
-                    y = -v->y;
-                }
-#else // PIXEL INDICATOR
-                // Maybe this is horrendously slow because it has to draw a quad for every output pixel? 
-                // It looks cool though
-                for (size_t i = 0; i < d->pixels.length; i++) {
-                    double x = d->pixels.xs[i];
-                    double y = d->pixels.ys[i];
-                    double dx = config.ui.point_thickness;
-                    double dy = config.ui.point_thickness;
-                    glVertex2d(x + dx, y);
-                    glVertex2d(x, y + dy);
-                    glVertex2d(x - dx, y);
-                    glVertex2d(x, y - dy);
-                }
-#endif
+            // One diamond per output pixel, all in a single instanced draw
+            update_strips();
+            if(strip_count > 0) {
+                location = gl_uniform(strip_shader, "iPointSize");
+                glUniform1f(location, config.ui.point_thickness);
+
+                glBindBuffer(GL_ARRAY_BUFFER, strip_vbo);
+                glEnableVertexAttribArray(SHADER_ATTRIB_VERTEX);
+                glVertexAttribPointer(SHADER_ATTRIB_VERTEX, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+                glEnableVertexAttribArray(strip_point);
+                glVertexAttribPointer(strip_point, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid *) sizeof strip_marker);
+                glVertexAttribDivisor(strip_point, 1);
+
+                glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, strip_count);
+
+                glVertexAttribDivisor(strip_point, 0);
+                glDisableVertexAttribArray(strip_point);
+                glDisableVertexAttribArray(SHADER_ATTRIB_VERTEX);
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
             }
-            glEnd();
             break;
         default:
         case STRIPS_NONE:
@@ -746,62 +739,59 @@ static void ui_render(bool select) {
     }
 
     // Render the patterns
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, pat_fb);
+    glBindFramebuffer(GL_FRAMEBUFFER, pat_fb);
 
     int pw = config.ui.pattern_width;
     int ph = config.ui.pattern_height;
-    glUseProgramObjectARB(pat_shader);
-    location = glGetUniformLocationARB(pat_shader, "iResolution");
-    glUniform2fARB(location, pw, ph);
-    glUseProgramObjectARB(pat_shader);
-    location = glGetUniformLocationARB(pat_shader, "iSelection");
-    glUniform1iARB(location, select);
-    location = glGetUniformLocationARB(pat_shader, "iPreview");
-    glUniform1iARB(location, 0);
-    location = glGetUniformLocationARB(pat_shader, "iName");
-    glUniform1iARB(location, 1);
-    GLint pattern_index = glGetUniformLocationARB(pat_shader, "iPatternIndex");
-    GLint pattern_intensity = glGetUniformLocationARB(pat_shader, "iIntensity");
-    GLint name_resolution = glGetUniformLocationARB(pat_shader, "iNameResolution");
-
-    glLoadIdentity();
-    gluOrtho2D(0, pw, 0, ph);
+    glUseProgram(pat_shader);
+    location = gl_uniform(pat_shader, "iResolution");
+    glUniform2f(location, pw, ph);
+    glUseProgram(pat_shader);
+    location = gl_uniform(pat_shader, "iSelection");
+    glUniform1i(location, select);
+    location = gl_uniform(pat_shader, "iPreview");
+    glUniform1i(location, 0);
+    GLint pattern_index = gl_uniform(pat_shader, "iPatternIndex");
+    GLint pattern_intensity = gl_uniform(pat_shader, "iIntensity");
+
     glViewport(0, 0, pw, ph);
 
     for(int i = 0; i < config.ui.n_patterns; i++) {
         struct pattern * p = deck[map_deck[i]].pattern[map_pattern[i]];
         if(p != NULL) {
+            glUseProgram(pat_shader);
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, p->tex_output);
-            glActiveTexture(GL_TEXTURE1);
-            SDL_GL_BindTexture(pattern_name_textures[i], NULL, NULL);
-            glUniform1iARB(pattern_index, i);
-            glUniform1fARB(pattern_intensity, p->intensity);
-            glUniform2fARB(name_resolution, pattern_name_width[i], pattern_name_height[i]);
-            glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, pattern_textures[i], 0);
+            glUniform1i(pattern_index, i);
+            glUniform1f(pattern_intensity, p->intensity);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pattern_textures[i], 0);
             glClear(GL_COLOR_BUFFER_BIT);
-            fill(pw, ph);
+            gl_fill();
+            if(!select) {
+                text_draw(p->name, 25, 210);
+                text_flush();
+            }
         }
     }
 
     // Render the crossfader
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, crossfader_fb);
+    glBindFramebuffer(GL_FRAMEBUFFER, crossfader_fb);
 
     int cw = config.ui.crossfader_width;
     int ch = config.ui.crossfader_height;
-    glUseProgramObjectARB(crossfader_shader);
-    location = glGetUniformLocationARB(crossfader_shader, "iResolution");
-    glUniform2fARB(location, cw, ch);
-    location = glGetUniformLocationARB(crossfader_shader, "iSelection");
-    glUniform1iARB(location, select);
-    location = glGetUniformLocationARB(crossfader_shader, "iPreview");
-    glUniform1iARB(location, 0);
-    location = glGetUniformLocationARB(crossfader_shader, "iStrips");
-    glUniform1iARB(location, 1);
-    location = glGetUniformLocationARB(crossfader_shader, "iIntensity");
-    glUniform1fARB(location, crossfader.position);
-    location = glGetUniformLocationARB(crossfader_shader, "iIndicator");
-    glUniform1iARB(location, strip_indicator);
+    glUseProgram(crossfader_shader);
+    location = gl_uniform(crossfader_shader, "iResolution");
+    glUniform2f(location, cw, ch);
+    location = gl_uniform(crossfader_shader, "iSelection");
+    glUniform1i(location, select);
+    location = gl_uniform(crossfader_shader, "iPreview");
+    glUniform1i(location, 0);
+    location = gl_uniform(crossfader_shader, "iStrips");
+    glUniform1i(location, 1);
+    location = gl_uniform(crossfader_shader, "iIntensity");
+    glUniform1f(location, crossfader.position);
+    location = gl_uniform(crossfader_shader, "iIndicator");
+    glUniform1i(location, strip_indicator);
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, crossfader.tex_output);
@@ -809,11 +799,9 @@ static void ui_render(bool select) {
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, strip_texture);
 
-    glLoadIdentity();
-    gluOrtho2D(0, cw, 0, ch);
     glViewport(0, 0, cw, ch);
     glClear(GL_COLOR_BUFFER_BIT);
-    fill(cw, ch);
+    gl_fill();
 
     int sw = 0;
     int sh = 0;
@@ -823,86 +811,80 @@ static void ui_render(bool select) {
         analyze_render(tex_spectrum_data, tex_waveform_data, tex_waveform_beats_data);
 
         // Render the spectrum
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, spectrum_fb);
+        glBindFramebuffer(GL_FRAMEBUFFER, spectrum_fb);
 
         sw = config.ui.spectrum_width;
         sh = config.ui.spectrum_height;
-        glUseProgramObjectARB(spectrum_shader);
-        location = glGetUniformLocationARB(spectrum_shader, "iResolution");
-        glUniform2fARB(location, sw, sh);
-        location = glGetUniformLocationARB(spectrum_shader, "iBins");
-        glUniform1iARB(location, config.audio.spectrum_bins);
-        location = glGetUniformLocationARB(spectrum_shader, "iSpectrum");
-        glUniform1iARB(location, 0);
+        glUseProgram(spectrum_shader);
+        location = gl_uniform(spectrum_shader, "iResolution");
+        glUniform2f(location, sw, sh);
+        location = gl_uniform(spectrum_shader, "iBins");
+        glUniform1i(location, config.audio.spectrum_bins);
+        location = gl_uniform(spectrum_shader, "iSpectrum");
+        glUniform1i(location, 0);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_1D, tex_spectrum_data);
 
-        glLoadIdentity();
-        gluOrtho2D(0, sw, 0, sh);
         glViewport(0, 0, sw, sh);
         glClear(GL_COLOR_BUFFER_BIT);
-        fill(sw, sh);
+        gl_fill();
 
         // Render the waveform
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, waveform_fb);
+        glBindFramebuffer(GL_FRAMEBUFFER, waveform_fb);
 
         vw = config.ui.waveform_width;
         vh = config.ui.waveform_height;
-        glUseProgramObjectARB(waveform_shader);
-        location = glGetUniformLocationARB(waveform_shader, "iResolution");
-        glUniform2fARB(location, sw, sh);
-        location = glGetUniformLocationARB(waveform_shader, "iLength");
-        glUniform1iARB(location, config.audio.waveform_length);
-        location = glGetUniformLocationARB(waveform_shader, "iWaveform");
-        glUniform1iARB(location, 0);
-        location = glGetUniformLocationARB(waveform_shader, "iBeats");
-        glUniform1iARB(location, 1);
+        glUseProgram(waveform_shader);
+        location = gl_uniform(waveform_shader, "iResolution");
+        glUniform2f(location, sw, sh);
+        location = gl_uniform(waveform_shader, "iLength");
+        glUniform1i(location, config.audio.waveform_length);
+        location = gl_uniform(waveform_shader, "iWaveform");
+        glUniform1i(location, 0);
+        location = gl_uniform(waveform_shader, "iBeats");
+        glUniform1i(location, 1);
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_1D, tex_waveform_data);
         glActiveTexture(GL_TEXTURE1);
         glBindTexture(GL_TEXTURE_1D, tex_waveform_beats_data);
 
-        glLoadIdentity();
-        gluOrtho2D(0, vw, 0, vh);
         glViewport(0, 0, vw, vh);
         glClear(GL_COLOR_BUFFER_BIT);
-        fill(vw, vh);
+        gl_fill();
     }
 
     // Render to screen (or select fb)
     if(select) {
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, select_fb);
+        glBindFramebuffer(GL_FRAMEBUFFER, select_fb);
     } else {
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
-    glLoadIdentity();
-    gluOrtho2D(0, ww, 0, wh);
     glViewport(0, 0, ww, wh);
 
     glClear(GL_COLOR_BUFFER_BIT);
 
-    glUseProgramObjectARB(main_shader);
+    glUseProgram(main_shader);
 
-    location = glGetUniformLocationARB(main_shader, "iResolution");
-    glUniform2fARB(location, ww, wh);
-    location = glGetUniformLocationARB(main_shader, "iSelection");
-    glUniform1iARB(location, select);
-    location = glGetUniformLocationARB(main_shader, "iSelected");
-    glUniform1iARB(location, selected);
-    location = glGetUniformLocationARB(main_shader, "iLeftDeckSelector");
-    glUniform1iARB(location, left_deck_selector);
-    location = glGetUniformLocationARB(main_shader, "iRightDeckSelector");
-    glUniform1iARB(location, right_deck_selector);
+    location = gl_uniform(main_shader, "iResolution");
+    glUniform2f(location, ww, wh);
+    location = gl_uniform(main_shader, "iSelection");
+    glUniform1i(location, select);
+    location = gl_uniform(main_shader, "iSelected");
+    glUniform1i(location, selected);
+    location = gl_uniform(main_shader, "iLeftDeckSelector");
+    glUniform1i(location, crossfader.left_deck);
+    location = gl_uniform(main_shader, "iRightDeckSelector");
+    glUniform1i(location, crossfader.right_deck);
 
-    fill(ww, wh);
+    gl_fill();
 
     // Blit UI elements on top
     glEnable(GL_BLEND);
-    glUseProgramObjectARB(blit_shader);
+    glUseProgram(blit_shader);
     glActiveTexture(GL_TEXTURE0);
-    location = glGetUniformLocationARB(blit_shader, "iTexture");
-    glUniform1iARB(location, 0);
+    location = gl_uniform(blit_shader, "iTexture");
+    glUniform1i(location, 0);
 
     for(int i = 0; i < config.ui.n_patterns; i++) {
         struct pattern * pattern = deck[map_deck[i]].pattern[map_pattern[i]];
@@ -945,12 +927,33 @@ struct rgba {
     uint8_t a;
 };
 
+// Draw the selection buffer, if anything that can be clicked on has moved since it was last drawn
+static void update_select() {
+    struct select_layout layout;
+    memset(&layout, 0, sizeof layout);
+    for(int i = 0; i < config.ui.n_patterns; i++) {
+        const struct pattern * p = deck[map_deck[i]].pattern[map_pattern[i]];
+        layout.loaded[i] = p != NULL;
+        if(p != NULL) layout.intensity[i] = p->intensity;
+    }
+    layout.crossfader = crossfader.position;
+    layout.left_deck = crossfader.left_deck;
+    layout.right_deck = crossfader.right_deck;
+    layout.selected = selected;
+
+    if(select_valid && memcmp(&layout, &select_layout, sizeof layout) == 0) return;
+    ui_render(true);
+    select_layout = layout;
+    select_valid = true;
+}
+
 static struct rgba test_hit(int x, int y) {
     struct rgba data;
 
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, select_fb);
+    update_select();
+    glBindFramebuffer(GL_FRAMEBUFFER, select_fb);
     glReadPixels(x, y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, &data);
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
     return data;
 }
 
@@ -984,9 +987,9 @@ static void handle_text(const char * text) {
         if(strlen(pat_entry_text) + strlen(text) < sizeof(pat_entry_text)) {
             strcat(pat_entry_text, text);
         }
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, pat_entry_fb);
+        glBindFramebuffer(GL_FRAMEBUFFER, pat_entry_fb);
         render_textbox(pat_entry_text, config.ui.pat_entry_width, config.ui.pat_entry_height);
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 }
 
@@ -1024,84 +1027,85 @@ static void handle_mouse_down() {
     }
 }
 
-void ui_run() {
-        SDL_Event e;
+// Mark the pattern outputs shown in the UI, so that deck_render() renders them
+void ui_mark_previews() {
+    if(headless) return;
+    for(int i = 0; i < config.ui.n_patterns; i++) {
+        struct pattern * p = deck[map_deck[i]].pattern[map_pattern[i]];
+        if(p != NULL) p->preview = true;
+    }
+}
 
-        quit = false;
-        while(!quit) {
-            ui_render(true);
+bool ui_poll() {
+    SDL_Event e;
 
-            while(SDL_PollEvent(&e) != 0) {
-                if (midi_command_event != (Uint32) -1 && 
-                    e.type == midi_command_event) {
-                    struct midi_event * me = e.user.data1;
-                    switch (me->type) {
-                    case MIDI_EVENT_SLIDER:
-                        set_slider_to(me->slider.index, me->slider.value, me->snap);
-                        break;
-                    case MIDI_EVENT_KEY:;
-                        SDL_KeyboardEvent fakekeyev;
-                        memset(&fakekeyev, 0, sizeof fakekeyev);
-                        fakekeyev.type = SDL_KEYDOWN;
-                        fakekeyev.state = SDL_PRESSED;
-                        fakekeyev.keysym.sym = me->key.keycode[0];
-                        handle_key(&fakekeyev);
+    while(SDL_PollEvent(&e) != 0) {
+        if (midi_command_event != (Uint32) -1 && 
+            e.type == midi_command_event) {
+            struct midi_event * me = e.user.data1;
+            switch (me->type) {
+            case MIDI_EVENT_SLIDER:
+                set_slider_to(me->slider.index, me->slider.value, me->snap);
+                break;
+            case MIDI_EVENT_KEY:;
+                SDL_KeyboardEvent fakekeyev;
+                memset(&fakekeyev, 0, sizeof fakekeyev);
+                fakekeyev.type = SDL_KEYDOWN;
+                fakekeyev.state = SDL_PRESSED;
+                fakekeyev.keysym.sym = me->key.keycode[0];
+                handle_key(&fakekeyev);
+                break;
+            }
+            free(e.user.data1);
+            free(e.user.data2);
+            continue;
+        }
+        switch(e.type) {
+            case SDL_QUIT:
+                quit = true;
+                break;
+            case SDL_KEYDOWN:
+                handle_key(&e.key);
+                break;
+            case SDL_MOUSEMOTION:
+                mx = e.motion.x;
+                my = e.motion.y;
+                handle_mouse_move();
+                break;
+            case SDL_MOUSEBUTTONDOWN:
+                mx = e.button.x;
+                my = e.button.y;
+                switch(e.button.button) {
+                    case SDL_BUTTON_LEFT:
+                        handle_mouse_down();
                         break;
-                    }
-                    free(e.user.data1);
-                    free(e.user.data2);
-                    continue;
                 }
-                switch(e.type) {
-                    case SDL_QUIT:
-                        quit = true;
-                        break;
-                    case SDL_KEYDOWN:
-                        handle_key(&e.key);
-                        break;
-                    case SDL_MOUSEMOTION:
-                        mx = e.motion.x;
-                        my = e.motion.y;
-                        handle_mouse_move();
-                        break;
-                    case SDL_MOUSEBUTTONDOWN:
-                        mx = e.button.x;
-                        my = e.button.y;
-                        switch(e.button.button) {
-                            case SDL_BUTTON_LEFT:
-                                handle_mouse_down();
-                                break;
-                        }
-                        break;
-                    case SDL_MOUSEBUTTONUP:
-                        mx = e.button.x;
-                        my = e.button.y;
-                        switch(e.button.button) {
-                            case SDL_BUTTON_LEFT:
-                                handle_mouse_up();
-                                break;
-                        }
-                        break;
-                    case SDL_TEXTINPUT:
-                        handle_text(e.text.text);
+                break;
+            case SDL_MOUSEBUTTONUP:
+                mx = e.button.x;
+                my = e.button.y;
+                switch(e.button.button) {
+                    case SDL_BUTTON_LEFT:
+                        handle_mouse_up();
                         break;
                 }
-            }
-
-            for(int i=0; i<N_DECKS; i++) {
-                deck_render(&deck[i]);
-            }
-            crossfader_render(&crossfader, deck[left_deck_selector].tex_output, deck[right_deck_selector].tex_output);
-            ui_render(false);
+                break;
+            case SDL_TEXTINPUT:
+                handle_text(e.text.text);
+                break;
+        }
+    }
+    return !quit;
+}
 
-            render_readback(&render);
+void ui_draw() {
+    for(int i = 0; i < config.ui.n_patterns; i++) {
+        if(deck[map_deck[i]].swapped) redraw_pattern_ui(i);
+    }
+    for(int i=0; i<N_DECKS; i++) deck[i].swapped = false;
 
-            SDL_GL_SwapWindow(window);
+    if(headless) return;
 
-            double cur_t = SDL_GetTicks();
-            double dt = cur_t - l_t;
-            if(dt > 0) time += dt / 1000;
-            l_t = cur_t;
-        }
+    ui_render(false);
+    SDL_GL_SwapWindow(window);
 }
-
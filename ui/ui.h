@@ -1,8 +1,16 @@
 #ifndef __UI_H
 #define __UI_H
 
+#include <stdbool.h>
+
 void ui_init();
-void ui_run();
 void ui_term();
 
+// Handles pending events; returns false once the user has quit
+bool ui_poll();
+// Marks the patterns the UI will show, before the decks are rendered
+void ui_mark_previews();
+// Draws the UI from the latest engine textures
+void ui_draw();
+
 #endif
@@ -0,0 +1,159 @@
+#include "util/gl.h"
+
+#include "util/err.h"
+#include "util/opengl.h"
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UNIFORM_BUCKETS 256
+
+bool gl_core = false;
+bool gl_compute = false;
+static bool gl_timer_queries = false;
+
+// Shared by every draw call on a core context, which can't draw without one
+static GLuint vao = 0;
+
+struct uniform {
+    struct uniform * next;
+    GLuint program;
+    GLint location;
+    char name[];
+};
+static struct uniform * uniforms[UNIFORM_BUCKETS];
+
+void gl_init(bool core) {
+    GLenum e;
+
+    gl_core = core;
+    if(gl_core) {
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+    }
+
+    int major = 0, minor = 0;
+    sscanf((const char *) glGetString(GL_VERSION), "%d.%d", &major, &minor);
+    gl_compute = major > 4 || (major == 4 && minor >= 3);
+    gl_timer_queries = major > 3 || (major == 3 && minor >= 3) || SDL_GL_ExtensionSupported("GL_ARB_timer_query");
+
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+    INFO("Using OpenGL %s (%s profile)", glGetString(GL_VERSION), gl_core ? "core" : "legacy");
+}
+
+void gl_term() {
+    if(vao != 0) {
+        glBindVertexArray(0);
+        glDeleteVertexArrays(1, &vao);
+        vao = 0;
+    }
+    for(int i = 0; i < UNIFORM_BUCKETS; i++) {
+        while(uniforms[i] != NULL) {
+            struct uniform * u = uniforms[i];
+            uniforms[i] = u->next;
+            free(u);
+        }
+    }
+}
+
+void gl_fill() {
+    if(gl_core) {
+        // The vertex shader from load_shader() places the corners from gl_VertexID
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    } else {
+        glBegin(GL_TRIANGLES);
+        glVertex2f(-1, -1);
+        glVertex2f(3, -1);
+        glVertex2f(-1, 3);
+        glEnd();
+    }
+}
+
+// FNV-1a
+static unsigned int uniform_bucket(GLuint program, const char * name) {
+    uint32_t hash = 0x811c9dc5 ^ program;
+    for(const char * c = name; *c != '\0'; c++) {
+        hash ^= (unsigned char) *c;
+        hash *= 0x01000193;
+    }
+    return hash % UNIFORM_BUCKETS;
+}
+
+GLint gl_uniform(GLuint program, const char * name) {
+    unsigned int bucket = uniform_bucket(program, name);
+    for(struct uniform * u = uniforms[bucket]; u != NULL; u = u->next) {
+        if(u->program == program && strcmp(u->name, name) == 0) return u->location;
+    }
+
+    struct uniform * u = malloc(sizeof *u + strlen(name) + 1);
+    if(u == NULL) MEMFAIL();
+    u->program = program;
+    u->location = glGetUniformLocation(program, name);
+    strcpy(u->name, name);
+    u->next = uniforms[bucket];
+    uniforms[bucket] = u;
+    return u->location;
+}
+
+void gl_delete_program(GLuint program) {
+    if(program == 0) return;
+    for(int i = 0; i < UNIFORM_BUCKETS; i++) {
+        for(struct uniform ** u = &uniforms[i]; *u != NULL; ) {
+            if((*u)->program == program) {
+                struct uniform * dead = *u;
+                *u = dead->next;
+                free(dead);
+            } else {
+                u = &(*u)->next;
+            }
+        }
+    }
+    glDeleteProgram(program);
+}
+
+void gl_timer_init(struct gl_timer * timer) {
+    memset(timer, 0, sizeof *timer);
+    if(gl_timer_queries) glGenQueries(GL_TIMER_QUERIES, timer->queries);
+}
+
+void gl_timer_term(struct gl_timer * timer) {
+    if(gl_timer_queries) glDeleteQueries(GL_TIMER_QUERIES, timer->queries);
+    memset(timer, 0, sizeof *timer);
+}
+
+void gl_timer_begin(struct gl_timer * timer) {
+    if(!gl_timer_queries) return;
+
+    // Collect whatever has finished, oldest first
+    while(timer->n_pending > 0) {
+        GLuint query = timer->queries[(timer->head + GL_TIMER_QUERIES - timer->n_pending) % GL_TIMER_QUERIES];
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available && timer->n_pending < GL_TIMER_QUERIES) break;
+
+        // With every query in flight, wait rather than reuse one
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+        timer->total_ms += ns / 1e6;
+        timer->n_results++;
+        timer->n_pending--;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, timer->queries[timer->head]);
+}
+
+void gl_timer_end(struct gl_timer * timer) {
+    if(!gl_timer_queries) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    timer->head = (timer->head + 1) % GL_TIMER_QUERIES;
+    timer->n_pending++;
+}
+
+double gl_timer_average(struct gl_timer * timer) {
+    if(timer->n_results == 0) return -1;
+    double average = timer->total_ms / timer->n_results;
+    timer->total_ms = 0;
+    timer->n_results = 0;
+    return average;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+#include <stdbool.h>
+
+// Set when running on a 3.3 core profile context (`config.render.gl_core`),
+// rather than the legacy fixed-function one
+extern bool gl_core;
+
+// Set when the context can run compute shaders (GL 4.3)
+extern bool gl_compute;
+
+// Set up the state shared by everything that draws; call once the context is current
+void gl_init(bool core);
+void gl_term();
+
+// Cover the whole viewport with the current program.
+// Fragment shaders only get gl_FragCoord, so draw a sub-rectangle by narrowing the viewport
+void gl_fill();
+
+// Uniform location, looked up once per program
+GLint gl_uniform(GLuint program, const char * name);
+
+// Delete a program along with its cached uniform locations
+void gl_delete_program(GLuint program);
+
+#define GL_TIMER_QUERIES 4 // Frames a timer result may take to come back
+
+// GPU time spent on a stretch of commands each frame. Results are picked up
+// a few frames late so that nothing waits on the GPU; without timer queries
+// (GL 3.3 or ARB_timer_query) nothing is measured
+struct gl_timer {
+    GLuint queries[GL_TIMER_QUERIES];
+    int head;
+    int n_pending;
+    double total_ms;
+    int n_results;
+};
+
+void gl_timer_init(struct gl_timer * timer);
+void gl_timer_term(struct gl_timer * timer);
+void gl_timer_begin(struct gl_timer * timer);
+void gl_timer_end(struct gl_timer * timer);
+// Average in milliseconds since the last call, or a negative number if there is nothing to show
+double gl_timer_average(struct gl_timer * timer);
@@ -1,22 +1,57 @@
 #include "util/glsl.h"
 #include "util/err.h"
+#include "util/gl.h"
 
 #include "util/string.h"
+#include "util/config.h"
+#include <SDL2/SDL.h>
 #include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
 char * load_shader_error = 0;
 
-/*
-const char default_vertex_shader[] = "                          \n\
-#version 130                                                    \n\
-void main(void) {                                               \n\
-    gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;     \n\
-}                                                               \n\
-";
-*/
+// Not all SDL_opengl.h versions know about KHR_parallel_shader_compile
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// Every source starts with one of these, so that the same GLSL builds on either context
+static const char legacy_fragment_prelude[] =
+    "#version 120\n"
+    "#extension GL_ARB_uniform_buffer_object : enable\n";
+static const char legacy_vertex_prelude[] =
+    "#version 120\n";
+static const char core_fragment_prelude[] =
+    "#version 330 core\n"
+    "#define varying in\n"
+    "#define texture1D texture\n"
+    "#define texture2D texture\n"
+    "out vec4 FragColor;\n"
+    "#define gl_FragColor FragColor\n";
+// Compute shaders (GL 4.3) stand in for a fragment shader: gl_FragCoord is
+// set by the shader itself before it runs any fragment code
+static const char compute_prelude[] =
+    "#version 430\n"
+    "#define texture1D texture\n"
+    "#define texture2D texture\n"
+    "vec4 iComputeFragCoord;\n"
+    "#define gl_FragCoord iComputeFragCoord\n";
+static const char core_vertex_prelude[] =
+    "#version 330 core\n"
+    "#define attribute in\n"
+    "#define varying out\n";
+
+// Core contexts have no fixed-function vertex stage; this covers the viewport for gl_fill()
+static const char fill_vertex_shader[] =
+    "void main(void) {\n"
+    "    gl_Position = vec4(vec2(gl_VertexID & 1, gl_VertexID >> 1) * 4. - 1., 0., 1.);\n"
+    "}\n";
 
 static char * read_file(const char * filename, ssize_t * length) {
     char * buffer = 0;
@@ -61,96 +96,304 @@ static char * read_file(const char * filename, ssize_t * length) {
     return buffer;
 }
 
-GLhandleARB load_shader(const char * filename) {
-    // Load file
-    GLcharARB * buffer = NULL;
-    GLint length;
-    ssize_t prog_len = 0, head_len = 0;
-    char * prog_buffer = read_file(filename, &prog_len);
-    char * head_buffer = read_file("resources/header.glsl", &head_len);
-    if (prog_buffer != NULL || head_buffer != NULL) {
-        buffer = rsprintf("%s%s", head_buffer, prog_buffer);
+static bool caps_checked = false;
+static bool parallel_compile = false;
+static bool program_binary = false;
+static uint64_t driver_hash;
+
+// header.glsl is prepended to every shader; keep it around until it changes
+static char * header_text = NULL;
+static time_t header_mtime = 0;
+
+// Programs being compiled from source, to be written to the cache once linked
+struct cache_pending {
+    GLuint program;
+    uint64_t hash;
+};
+static struct cache_pending * cache_pending = NULL;
+static size_t n_cache_pending = 0;
+
+// FNV-1a
+static uint64_t hash_bytes(uint64_t hash, const void * data, size_t length) {
+    const unsigned char * p = data;
+    for(size_t i = 0; i < length; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
     }
-    free(prog_buffer);
-    free(head_buffer);
-    if (buffer == NULL) return 0;
-    length = strlen(buffer);
-
-    GLint compiled;
-
-    // Compile
-    GLhandleARB fragmentShaderObj;
-    fragmentShaderObj = glCreateShaderObjectARB(GL_FRAGMENT_SHADER);
-    // The two are effectively the same except for signed/unsigned, but Mac GCC complains
-    // if we're not careful about passing to ARB/mainline functions.  The whole thing
-    // should probably just be switched over to the mainline functions at some point.
-    GLuint fragmentShader = (GLuint) fragmentShaderObj;
-
-    glShaderSourceARB(fragmentShaderObj, 1, (const GLcharARB **)&buffer, (const GLint *)&length);
-    glCompileShader(fragmentShader);
-    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &compiled);
-    if(!compiled) {
-        GLint blen = 0; 
-        GLsizei slen = 0;
+    return hash;
+}
 
-        glGetShaderiv(fragmentShader, GL_INFO_LOG_LENGTH , &blen);
-        if(blen > 1) {
-            GLchar* compiler_log = (GLchar*)calloc(blen, 1);
-            glGetShaderInfoLog(fragmentShader, blen, &slen, compiler_log);
-            load_shader_error = rsprintf("Shader compilation failed, Log:\n%s", compiler_log);
-            free(compiler_log);
-        } else {
-            load_shader_error = strdup("Shader compilation failed!");
+static uint64_t hash_string(uint64_t hash, const char * s) {
+    return hash_bytes(hash, s, strlen(s) + 1);
+}
+
+static void load_shader_caps() {
+    if(caps_checked) return;
+    caps_checked = true;
+
+    parallel_compile = SDL_GL_ExtensionSupported("GL_KHR_parallel_shader_compile")
+                    || SDL_GL_ExtensionSupported("GL_ARB_parallel_shader_compile");
+    if(parallel_compile) INFO("Compiling shaders in parallel");
+
+    if(config.paths.shader_cache[0] == '\0') return;
+    GLint n_formats = 0;
+    if(SDL_GL_ExtensionSupported("GL_ARB_get_program_binary"))
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &n_formats);
+    if(n_formats <= 0) {
+        INFO("Driver can't save program binaries, not caching shaders");
+        return;
+    }
+    if(mkdir(config.paths.shader_cache, 0755) != 0 && errno != EEXIST) {
+        WARN("Could not create shader cache %s (%s)", config.paths.shader_cache, strerror(errno));
+        return;
+    }
+    program_binary = true;
+
+    // A driver update invalidates every binary
+    driver_hash = 0xcbf29ce484222325ULL;
+    driver_hash = hash_string(driver_hash, (const char *) glGetString(GL_VENDOR));
+    driver_hash = hash_string(driver_hash, (const char *) glGetString(GL_RENDERER));
+    driver_hash = hash_string(driver_hash, (const char *) glGetString(GL_VERSION));
+}
+
+static const char * load_header() {
+    static const char header_filename[] = "resources/header.glsl";
+    struct stat statbuf;
+
+    if(stat(header_filename, &statbuf) != 0) {
+        load_shader_error = rsprintf("Could not open file: %s (%s)", header_filename, strerror(errno));
+        return NULL;
+    }
+    if(header_text != NULL && statbuf.st_mtime == header_mtime) return header_text;
+
+    ssize_t length;
+    char * text = read_file(header_filename, &length);
+    if(text == NULL) return NULL;
+    free(header_text);
+    header_text = text;
+    header_mtime = statbuf.st_mtime;
+    return header_text;
+}
+
+static char * cache_filename(uint64_t hash) {
+    const char * dir = config.paths.shader_cache;
+    const char * separator = dir[strlen(dir) - 1] == '/' ? "" : "/";
+    char * filename = rsprintf("%s%s%016llx.bin", dir, separator, (unsigned long long) hash);
+    if(filename == NULL) MEMFAIL();
+    return filename;
+}
+
+// Returns a linked program, or 0 if there is no usable cached binary
+static GLuint cache_load(uint64_t hash) {
+    char * filename = cache_filename(hash);
+    FILE * f = fopen(filename, "rb");
+    free(filename);
+    if(f == NULL) return 0;
+
+    GLuint program = 0;
+    GLenum format;
+    long length = 0;
+    void * binary = NULL;
+    if(fread(&format, sizeof format, 1, f) != 1) goto done;
+    if(fseek(f, 0, SEEK_END) != 0 || (length = ftell(f) - (long) sizeof format) <= 0) goto done;
+    if(fseek(f, sizeof format, SEEK_SET) != 0) goto done;
+    binary = malloc(length);
+    if(binary == NULL) MEMFAIL();
+    if(fread(binary, 1, length, f) != (size_t) length) goto done;
+
+    program = glCreateProgram();
+    glProgramBinary(program, format, binary, length);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if(!linked) {
+        // Usually means the driver changed in a way its version string doesn't show
+        glDeleteProgram(program);
+        program = 0;
+    }
+done:
+    free(binary);
+    fclose(f);
+    return program;
+}
+
+static void cache_save(GLuint program, uint64_t hash) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0) return;
+
+    void * binary = malloc(length);
+    if(binary == NULL) MEMFAIL();
+    GLenum format;
+    glGetProgramBinary(program, length, NULL, &format, binary);
+
+    // Write to a temporary file first so a crash never leaves a truncated binary behind
+    char * filename = cache_filename(hash);
+    char * tmp_filename = rsprintf("%s.tmp", filename);
+    if(tmp_filename == NULL) MEMFAIL();
+    FILE * f = fopen(tmp_filename, "wb");
+    if(f == NULL) {
+        WARN("Could not write to shader cache %s (%s)", tmp_filename, strerror(errno));
+    } else {
+        bool ok = fwrite(&format, sizeof format, 1, f) == 1
+               && fwrite(binary, 1, length, f) == (size_t) length;
+        ok = (fclose(f) == 0) && ok;
+        if(ok) ok = rename(tmp_filename, filename) == 0;
+        if(!ok) {
+            WARN("Could not write to shader cache %s (%s)", filename, strerror(errno));
+            remove(tmp_filename);
         }
-        glDeleteObjectARB(fragmentShaderObj);
-        free(buffer);
-        return 0;
     }
-    free(buffer);
+    free(binary);
+    free(filename);
+    free(tmp_filename);
+}
 
-    /*
-    length = sizeof(default_vertex_shader) - 1;
-    buffer = calloc(length, 1);
-    if(buffer == NULL) {
-        load_shader_error = rsprintf("Could not allocate memory for default vertex shader");
-        return 0;
+char * load_shader_source(const char * filename) {
+    ssize_t length = 0;
+    return read_file(filename, &length);
+}
+
+GLuint load_shader_async(const char * filename) {
+    char * source = load_shader_source(filename);
+    if (source == NULL) return 0;
+    GLuint program = load_shader_source_async(source);
+    free(source);
+    return program;
+}
+
+static GLuint load_stage(GLenum type, const char * source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    return shader;
+}
+
+// The fragment (or compute) shader gets header.glsl prepended; the vertex shader (if any) only the prelude.
+// Without a vertex shader, core contexts get one that works with gl_fill()
+static GLuint load_program_async(const char * vertex_source, const char * fragment_source, GLenum type) {
+    load_shader_caps();
+
+    const char * prelude = gl_core ? core_fragment_prelude : legacy_fragment_prelude;
+    if(type == GL_COMPUTE_SHADER) prelude = compute_prelude;
+
+    char * buffer = NULL;
+    const char * head_buffer = load_header();
+    if (head_buffer != NULL) {
+        buffer = rsprintf("%s%s%s", prelude, head_buffer, fragment_source);
     }
-    memcpy(buffer, default_vertex_shader, sizeof(default_vertex_shader) - 1);
+    if (buffer == NULL) return 0;
+    size_t length = strlen(buffer);
 
-    // Compile default vertex shader
-    GLhandleARB vertexShaderObj;
-    vertexShaderObj = glCreateShaderObjectARB(GL_VERTEX_SHADER);
-    glShaderSourceARB(vertexShaderObj, 1, (const GLcharARB **)&buffer, (const GLint *)&length);
-    glCompileShader(vertexShaderObj);
-    glGetShaderiv(vertexShaderObj, GL_COMPILE_STATUS, &compiled);
-    if(!compiled) {
-        GLint blen = 0; 
-        GLsizei slen = 0;
+    char * vertex_buffer = NULL;
+    if(vertex_source == NULL && gl_core && type != GL_COMPUTE_SHADER) vertex_source = fill_vertex_shader;
+    if(vertex_source != NULL) {
+        vertex_buffer = rsprintf("%s%s", gl_core ? core_vertex_prelude : legacy_vertex_prelude, vertex_source);
+        if(vertex_buffer == NULL) MEMFAIL();
+    }
 
-        glGetShaderiv(vertexShaderObj, GL_INFO_LOG_LENGTH , &blen);
-        if(blen > 1) {
-            GLchar* compiler_log = (GLchar*)calloc(blen, 1);
-            glGetShaderInfoLog(vertexShaderObj, blen, &slen, compiler_log);
-            load_shader_error = rsprintf("Shader compilation failed!\n%s", compiler_log);
-            free(compiler_log);
-        } else {
-            load_shader_error = strdup("Shader compilation failed!");
+    // The complete source goes into the key, so editing a pattern
+    // or the header picks up a fresh binary
+    uint64_t hash = 0;
+    if(program_binary) {
+        hash = hash_bytes(driver_hash, buffer, length);
+        if(vertex_buffer != NULL) hash = hash_string(hash, vertex_buffer);
+        GLuint program = cache_load(hash);
+        if(program != 0) {
+            free(buffer);
+            free(vertex_buffer);
+            return program;
         }
-        glDeleteObjectARB(vertexShaderObj);
-        free(buffer);
-        return 0;
     }
+
+    // Compile & link without asking for the results, so that
+    // drivers with parallel compilation don't block here
+    GLuint program = glCreateProgram();
+    glAttachShader(program, load_stage(type, buffer));
     free(buffer);
-    */
-
-    // Link
-    GLhandleARB programObj;
-    programObj = glCreateProgramObjectARB();
-    GLuint program = (GLuint) programObj;
-    //glAttachShader(programObj, vertexShaderObj);
-    glAttachShader(program, fragmentShader);
+    if(vertex_buffer != NULL) {
+        glAttachShader(program, load_stage(GL_VERTEX_SHADER, vertex_buffer));
+        free(vertex_buffer);
+    }
+
+    // Legacy contexts only draw vertex arrays when attribute 0 is enabled
+    glBindAttribLocation(program, SHADER_ATTRIB_VERTEX, "iVertex");
+
+    if(program_binary) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        // Anything already recorded under this name belonged to a deleted program
+        for(size_t i = 0; i < n_cache_pending; i++) {
+            if(cache_pending[i].program == program) cache_pending[i] = cache_pending[--n_cache_pending];
+        }
+        cache_pending = realloc(cache_pending, (n_cache_pending + 1) * sizeof *cache_pending);
+        if(cache_pending == NULL) MEMFAIL();
+        cache_pending[n_cache_pending++] = (struct cache_pending) {.program = program, .hash = hash};
+    }
     glLinkProgram(program);
 
+    return program;
+}
+
+GLuint load_shader_source_async(const char * source) {
+    return load_program_async(NULL, source, GL_FRAGMENT_SHADER);
+}
+
+GLuint load_compute_source_async(const char * source) {
+    return load_program_async(NULL, source, GL_COMPUTE_SHADER);
+}
+
+static void load_shader_detach(GLuint program, GLuint * shaders, GLsizei n_shaders) {
+    for(GLsizei i = 0; i < n_shaders; i++) {
+        glDetachShader(program, shaders[i]);
+        glDeleteShader(shaders[i]);
+    }
+}
+
+static int load_shader_finish(GLuint program, bool wait) {
+
+    if(parallel_compile && !wait) {
+        GLint done = GL_FALSE;
+        glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+        if(!done) return 0;
+    }
+
+    GLuint shaders[2];
+    GLsizei n_shaders = 0;
+    glGetAttachedShaders(program, 2, &n_shaders, shaders);
+    if(n_shaders == 0) return 1; // Already finished, or loaded from the cache
+
+    bool cache = false;
+    uint64_t hash = 0;
+    for(size_t i = 0; i < n_cache_pending; i++) {
+        if(cache_pending[i].program == program) {
+            cache = true;
+            hash = cache_pending[i].hash;
+            cache_pending[i] = cache_pending[--n_cache_pending];
+            break;
+        }
+    }
+
+    for(GLsizei i = 0; i < n_shaders; i++) {
+        GLint compiled;
+        glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &compiled);
+        if(!compiled) {
+            GLint blen = 0; 
+            GLsizei slen = 0;
+
+            glGetShaderiv(shaders[i], GL_INFO_LOG_LENGTH , &blen);
+            if(blen > 1) {
+                GLchar* compiler_log = (GLchar*)calloc(blen, 1);
+                glGetShaderInfoLog(shaders[i], blen, &slen, compiler_log);
+                load_shader_error = rsprintf("Shader compilation failed, Log:\n%s", compiler_log);
+                free(compiler_log);
+            } else {
+                load_shader_error = strdup("Shader compilation failed!");
+            }
+            load_shader_detach(program, shaders, n_shaders);
+            gl_delete_program(program);
+            return -1;
+        }
+    }
+
     GLint linked;
     glGetProgramiv(program, GL_LINK_STATUS, &linked);
     if(!linked) {
@@ -166,12 +409,39 @@ GLhandleARB load_shader(const char * filename) {
         } else {
             load_shader_error = strdup("Shader linking failed!");
         }
-        glDetachShader(program, fragmentShader);
-        glDeleteObjectARB(fragmentShaderObj);
-        glDeleteObjectARB(programObj);
+        load_shader_detach(program, shaders, n_shaders);
+        gl_delete_program(program);
+        return -1;
+    }
+    load_shader_detach(program, shaders, n_shaders);
+    if(cache) cache_save(program, hash);
+    return 1;
+}
+
+int load_shader_poll(GLuint program) {
+    return load_shader_finish(program, false);
+}
+
+GLuint load_shader(const char * filename) {
+    GLuint program = load_shader_async(filename);
+    if(program == 0) return 0;
+    if(load_shader_finish(program, true) < 0) return 0;
+    return program;
+}
+
+GLuint load_program(const char * vertex_filename, const char * fragment_filename) {
+    char * vertex_source = load_shader_source(vertex_filename);
+    if(vertex_source == NULL) return 0;
+    char * fragment_source = load_shader_source(fragment_filename);
+    if(fragment_source == NULL) {
+        free(vertex_source);
         return 0;
     }
-    glDetachShader(program, fragmentShader);
-    glDeleteShader(fragmentShader);
-    return programObj;
+
+    GLuint program = load_program_async(vertex_source, fragment_source, GL_FRAGMENT_SHADER);
+    free(vertex_source);
+    free(fragment_source);
+    if(program == 0) return 0;
+    if(load_shader_finish(program, true) < 0) return 0;
+    return program;
 }
@@ -6,6 +6,28 @@
 
 extern char * load_shader_error;
 
-GLhandleARB load_shader(const char * filename);
+// Every program has its `iVertex` attribute (if any) bound here
+#define SHADER_ATTRIB_VERTEX 0
+
+GLuint load_shader(const char * filename);
+
+// Links a vertex & fragment shader; header.glsl is only prepended to the fragment shader
+GLuint load_program(const char * vertex_filename, const char * fragment_filename);
+
+// Starts compiling & linking a shader without waiting for the driver.
+// Returns 0 if the source could not be read
+GLuint load_shader_async(const char * filename);
+// Same, for source that has already been read (without header.glsl)
+GLuint load_shader_source_async(const char * source);
+// Same, as a compute shader; only when `gl_compute` is set
+GLuint load_compute_source_async(const char * source);
+
+// Reads a shader source file; returns NULL and sets load_shader_error on failure
+char * load_shader_source(const char * filename);
+
+// Returns 1 once the program is linked and usable, 0 while it is still
+// compiling, or -1 on failure (the program is deleted and
+// load_shader_error is set)
+int load_shader_poll(GLuint program);
 
 #endif
@@ -0,0 +1,99 @@
+#include "util/texpool.h"
+#include "util/err.h"
+#include "util/opengl.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+struct texpool_entry {
+    GLuint tex;
+    int width;
+    int height;
+    GLenum format;
+    bool in_use;
+};
+
+static struct texpool_entry * entries = NULL;
+static int n_entries = 0;
+static int n_in_use = 0;
+static struct texpool_stats stats;
+
+GLuint texpool_get(int width, int height, GLenum format) {
+    GLenum e;
+
+    for(int i = 0; i < n_entries; i++) {
+        struct texpool_entry * entry = &entries[i];
+        if(entry->in_use || entry->width != width || entry->height != height || entry->format != format)
+            continue;
+        entry->in_use = true;
+        n_in_use++;
+        if(n_in_use > stats.peak) stats.peak = n_in_use;
+        return entry->tex;
+    }
+
+    entries = realloc(entries, (n_entries + 1) * sizeof *entries);
+    if(entries == NULL) MEMFAIL();
+    struct texpool_entry * entry = &entries[n_entries++];
+    *entry = (struct texpool_entry) {
+        .width = width, .height = height,
+        .format = format,
+        .in_use = true,
+    };
+
+    glGenTextures(1, &entry->tex);
+    glBindTexture(GL_TEXTURE_2D, entry->tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if((e = glGetError()) != GL_NO_ERROR) FAIL("OpenGL error: %s\n", GLU_ERROR_STRING(e));
+
+    stats.allocations++;
+    n_in_use++;
+    if(n_in_use > stats.peak) stats.peak = n_in_use;
+    return entry->tex;
+}
+
+void texpool_put(GLuint tex) {
+    if(tex == 0) return;
+    for(int i = 0; i < n_entries; i++) {
+        if(entries[i].tex == tex) {
+            if(!entries[i].in_use) WARN("Texture %u returned to the pool twice", tex);
+            else n_in_use--;
+            entries[i].in_use = false;
+            return;
+        }
+    }
+    ERROR("Texture %u does not belong to the pool", tex);
+}
+
+void texpool_size(GLuint tex, int * width, int * height) {
+    *width = 0;
+    *height = 0;
+    for(int i = 0; i < n_entries; i++) {
+        if(entries[i].tex == tex) {
+            *width = entries[i].width;
+            *height = entries[i].height;
+            return;
+        }
+    }
+}
+
+void texpool_stats(struct texpool_stats * s) {
+    *s = stats;
+    s->size = n_entries;
+    s->in_use = n_in_use;
+}
+
+void texpool_term() {
+    for(int i = 0; i < n_entries; i++) {
+        glDeleteTextures(1, &entries[i].tex);
+    }
+    free(entries);
+    entries = NULL;
+    n_entries = 0;
+    n_in_use = 0;
+    stats = (struct texpool_stats) {0};
+}
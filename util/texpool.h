@@ -0,0 +1,21 @@
+#pragma once
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+// Pool of render target textures shared by patterns, decks and the crossfader.
+// Textures are keyed by size & format and are handed out uncleared.
+
+struct texpool_stats {
+    int size; // Number of textures in the pool
+    int in_use; // Number currently handed out
+    int peak; // Largest number ever handed out at once
+    unsigned long allocations; // Number of textures ever created
+};
+
+GLuint texpool_get(int width, int height, GLenum format);
+void texpool_put(GLuint tex);
+// Size of a texture from the pool; 0x0 if it isn't one
+void texpool_size(GLuint tex, int * width, int * height);
+void texpool_stats(struct texpool_stats * stats);
+void texpool_term();